@@ -1,10 +1,15 @@
 #include "app.h"
 #include "audio_backend.h"
+#include "audio_rt_check.h"
 #include "dialog_device_selection.h"
 #include "gui.h"
 #include "midi_backend.h"
+#include "peak_pyramid.h"
+#include "recording_catalog.h"
+#include "sample_cache.h"
 #include "settings.h"
 #include "sound.h"
+#include "tests.h"
 
 #include "client/manager.h"
 #include "client/window.h"
@@ -23,13 +28,16 @@
 
 #include "audio_stats_callback.h"
 #include "audio_buffer_callback.h"
+#include "audio_latency_callback.h"
 #include "audio_playback_callback.h"
 #include "audio_recording_callback.h"
 
 #include "dialog_device_selection.h"
 
+#include <cfloat>
 #include <cstdlib>
 #include <cstdio>
+#include <cstring>
 #include <utility>
 
 namespace
@@ -50,6 +58,7 @@ namespace
 	Callbacks::AudioRecordingCallback* audioRecordingCallback_ = nullptr;
 	Callbacks::AudioBufferCallback* audioBufferCallback_ = nullptr;
 	Callbacks::AudioPlaybackCallback* audioPlaybackCallback_ = nullptr;
+	Callbacks::AudioLatencyCallback* audioLatencyCallback_ = nullptr;
 
 	Gui::DialogDeviceSelection* dialogDeviceSelection_ = nullptr;
 	Gui::DeviceSelectionStatus deviceSelectionStatus_ = Gui::DeviceSelectionStatus::NONE;
@@ -62,6 +71,81 @@ namespace
 	}
 
 	Core::Map<Core::String, IAudioCallback*> callbacks_;
+
+	RecordingCatalog recordingCatalog_;
+	/// Decoded recordings shared between playback & analysis.
+	Sound::SampleCache sampleCache_;
+	/// Catalog entries matching the filter, only rebuilt when either changes.
+	Core::Vector<i32> filteredRecordings_;
+	char recordingFilter_[64] = {};
+	i32 selectedRecording_ = -1;
+
+	void FilterRecordings()
+	{
+		filteredRecordings_.clear();
+		for(i32 idx = 0; idx < recordingCatalog_.GetNumEntries(); ++idx)
+		{
+			if(strstr(recordingCatalog_.GetEntry(idx).fileName_, recordingFilter_))
+				filteredRecordings_.push_back(idx);
+		}
+	}
+
+	/// Scan recordings from previous sessions, and carry on numbering after them.
+	void ScanRecordings()
+	{
+		recordingCatalog_.Scan();
+		Core::AtomicExchg(&Sound::OutputStream::SoundBufferID, (i32)recordingCatalog_.GetMaxID());
+		FilterRecordings();
+	}
+
+	/// Peaks of the selected recording, loaded or built on a job.
+	const i32 WAVEFORM_PEAKS = 256;
+	Sound::PeakPyramid* peaks_ = nullptr;
+	Sound::PeakPyramid* loadingPeaks_ = nullptr;
+	Core::String peaksFileName_;
+	Job::Counter* peaksCounter_ = nullptr;
+	/// 0 idle, 1 loading, 2 loaded.
+	volatile i32 peaksState_ = 0;
+
+	void UpdatePeaks(const char* fileName)
+	{
+		if(Core::AtomicCmpExchg(&peaksState_, 0, 2) == 2)
+		{
+			Job::Manager::WaitForCounter(peaksCounter_, 0);
+			delete peaks_;
+			peaks_ = loadingPeaks_;
+			loadingPeaks_ = nullptr;
+		}
+
+		// Only one load in flight, the latest selection is picked up once it's done.
+		if(peaksState_ == 0 && strcmp(peaksFileName_.c_str(), fileName) != 0)
+		{
+			peaksFileName_ = fileName;
+			loadingPeaks_ = new Sound::PeakPyramid();
+			Core::AtomicExchg(&peaksState_, 1);
+
+			Job::JobDesc jobDesc;
+			jobDesc.func_ = [](i32 param, void* data) {
+				Sound::PeakPyramid* peaks = static_cast<Sound::PeakPyramid*>(data);
+				peaks->LoadOrBuild(peaksFileName_.c_str(), &sampleCache_);
+				Core::AtomicExchg(&peaksState_, 2);
+			};
+			jobDesc.param_ = 0;
+			jobDesc.data_ = loadingPeaks_;
+			jobDesc.name_ = "PeakPyramid load";
+			Job::Manager::RunJobs(&jobDesc, 1, &peaksCounter_);
+		}
+	}
+
+	const char* FindArg(int argc, char* const argv[], const char* name)
+	{
+		for(int idx = 1; idx < argc; ++idx)
+		{
+			if(strcmp(argv[idx], name) == 0)
+				return (idx + 1) < argc ? argv[idx + 1] : "";
+		}
+		return nullptr;
+	}
 }
 
 namespace App
@@ -77,6 +161,16 @@ namespace App
 
 		settings_.Load();
 
+		// Round trip tests of the file formats, for ctest.
+		if(FindArg(argc, argv, "-test"))
+			return Tests::RunAll();
+
+		if(FindArg(argc, argv, "-headless"))
+		{
+			Job::Manager::Scoped jobManager(4, 256, 256 * 1024);
+			return RunHeadless(argc, argv);
+		}
+
 		Client::Manager::Scoped clientManager;
 		Plugin::Manager::Scoped pluginManager;
 		Job::Manager::Scoped jobManager(4, 256, 256 * 1024);
@@ -94,6 +188,78 @@ namespace App
 		return 1;
 	}
 	
+	/**
+	 * Run the callback chain without audio hardware or a window.
+	 * Usage: -headless [sine|noise|silence|input.wav] [-out output.wav] [-duration seconds] [-realtime] [-workers n]
+	 */
+	int Manager::RunHeadless(int argc, char* const argv[])
+	{
+		AudioHeadlessSettings headlessSettings;
+		headlessSettings.bufferSize_ = settings_.audioSettings_.bufferSize_;
+		headlessSettings.sampleRate_ = settings_.audioSettings_.sampleRate_;
+		headlessSettings.duration_ = 10.0;
+
+		const char* source = FindArg(argc, argv, "-headless");
+		if(strcmp(source, "silence") == 0)
+			headlessSettings.source_ = AudioHeadlessSource::SILENCE;
+		else if(strcmp(source, "noise") == 0)
+			headlessSettings.source_ = AudioHeadlessSource::NOISE;
+		else if(strlen(source) > 0 && strcmp(source, "sine") != 0)
+		{
+			headlessSettings.source_ = AudioHeadlessSource::FILE;
+			headlessSettings.inputFile_ = source;
+			headlessSettings.duration_ = 0.0;
+		}
+
+		if(const char* outputFile = FindArg(argc, argv, "-out"))
+			headlessSettings.outputFile_ = outputFile;
+		if(const char* duration = FindArg(argc, argv, "-duration"))
+			headlessSettings.duration_ = atof(duration);
+		if(FindArg(argc, argv, "-realtime"))
+			headlessSettings.clock_ = AudioHeadlessClock::REALTIME;
+		if(const char* numWorkers = FindArg(argc, argv, "-workers"))
+			headlessSettings.numWorkers_ = atoi(numWorkers);
+
+		audioStatsCallback_ = new Callbacks::AudioStatsCallback();
+		ScanRecordings();
+		audioRecordingCallback_ = new Callbacks::AudioRecordingCallback(*audioStatsCallback_, &recordingCatalog_);
+		audioBufferCallback_ = new Callbacks::AudioBufferCallback();
+
+		IAudioCallback* recordingDeps[] = { audioStatsCallback_ };
+		audioBackend_.RegisterCallback(audioStatsCallback_, 0x1, 0x0);
+		audioBackend_.RegisterCallback(audioRecordingCallback_, 0xffffffff, 0x0, recordingDeps, 1);
+		audioBackend_.RegisterCallback(audioBufferCallback_, 0x1, 0x3);
+
+		Core::Timer timer;
+		timer.Mark();
+		if(!audioBackend_.StartHeadless(headlessSettings))
+			return 1;
+
+		while(audioBackend_.IsRunning())
+			Core::Sleep(0.01);
+		audioBackend_.StopDevice();
+		audioBackend_.LogStats();
+#if RT_CHECK_ENABLED
+		RTCheck::LogReports();
+#endif
+
+		const f64 elapsed = timer.GetTime();
+		if(headlessSettings.duration_ > 0.0)
+			Core::Log("Headless: processed %.2fs of audio in %.3fs (%.1fx realtime)\n",
+				headlessSettings.duration_, elapsed, headlessSettings.duration_ / Core::Max(elapsed, 0.000001));
+		else
+			Core::Log("Headless: processed \"%s\" in %.3fs\n", headlessSettings.inputFile_, elapsed);
+
+		audioBackend_.UnregisterCallback(audioStatsCallback_);
+		audioBackend_.UnregisterCallback(audioRecordingCallback_);
+		audioBackend_.UnregisterCallback(audioBufferCallback_);
+
+		delete audioRecordingCallback_;
+		delete audioStatsCallback_;
+		delete audioBufferCallback_;
+		return 0;
+	}
+
 	bool Manager::Initialize(int argc, char* const argv[])
 	{
 		window_ = new Client::Window("Music Practice App", 100, 100, 1024, 768, true);
@@ -125,14 +291,20 @@ namespace App
 		cmdList_ = new GPU::CommandList(GPU::Manager::GetHandleAllocator());
 
 		audioStatsCallback_ = new Callbacks::AudioStatsCallback();
-		audioRecordingCallback_ = new Callbacks::AudioRecordingCallback(*audioStatsCallback_);
+		ScanRecordings();
+		audioRecordingCallback_ = new Callbacks::AudioRecordingCallback(*audioStatsCallback_, &recordingCatalog_);
 		audioBufferCallback_ = new Callbacks::AudioBufferCallback();
-		audioPlaybackCallback_ = new Callbacks::AudioPlaybackCallback();
+		sampleCache_.SetBudget((i64)settings_.sampleCacheMB_ * 1024 * 1024);
+		audioPlaybackCallback_ = new Callbacks::AudioPlaybackCallback(&sampleCache_);
+		audioLatencyCallback_ = new Callbacks::AudioLatencyCallback();
 		
+		// Recording reads stats gathered in the same block.
+		IAudioCallback* recordingDeps[] = { audioStatsCallback_ };
 		audioBackend_.RegisterCallback(audioStatsCallback_, 0x1, 0x0);
-		audioBackend_.RegisterCallback(audioRecordingCallback_, 0x1, 0x0);
+		audioBackend_.RegisterCallback(audioRecordingCallback_, 0xffffffff, 0x0, recordingDeps, 1);
 		audioBackend_.RegisterCallback(audioBufferCallback_, 0x1, 0xf);
 		audioBackend_.RegisterCallback(audioPlaybackCallback_, 0x0, 0xf);
+		audioBackend_.RegisterCallback(audioLatencyCallback_, 0x1, 0xf);
 
 		dialogDeviceSelection_ = new Gui::DialogDeviceSelection(audioBackend_, settings_.audioSettings_);
 
@@ -150,6 +322,7 @@ namespace App
 		delete cmdList_;
 		delete window_;
 
+		audioBackend_.UnregisterCallback(audioLatencyCallback_);
 		audioBackend_.UnregisterCallback(audioPlaybackCallback_);
 		audioBackend_.UnregisterCallback(audioStatsCallback_);
 		audioBackend_.UnregisterCallback(audioRecordingCallback_);
@@ -158,8 +331,15 @@ namespace App
 		delete audioStatsCallback_;
 		delete audioRecordingCallback_;
 		delete audioBufferCallback_;
+		delete audioLatencyCallback_;
+		delete audioPlaybackCallback_;
 		delete dialogDeviceSelection_;
 
+		if(peaksCounter_)
+			Job::Manager::WaitForCounter(peaksCounter_, 0);
+		delete peaks_;
+		delete loadingPeaks_;
+
 		GPU::Manager::DestroyResource(cmdHandle_);
 		GPU::Manager::DestroyResource(fbsHandle_);
 		GPU::Manager::DestroyResource(scHandle_);
@@ -241,7 +421,15 @@ namespace App
 			deviceSelectionStatus_ = dialogDeviceSelection_->Update();
 			if(deviceSelectionStatus_ == Gui::DeviceSelectionStatus::SELECTED)
 			{
+				// Measured latency only holds for the configuration it was measured with.
+				const auto prevSettings = settings_.audioSettings_;
 				settings_.audioSettings_ = dialogDeviceSelection_->GetSettings();
+				const bool sameConfig = prevSettings.inputDevice_ == settings_.audioSettings_.inputDevice_ &&
+					prevSettings.outputDevice_ == settings_.audioSettings_.outputDevice_ &&
+					prevSettings.bufferSize_ == settings_.audioSettings_.bufferSize_ &&
+					prevSettings.sampleRate_ == settings_.audioSettings_.sampleRate_ &&
+					prevSettings.separateStreams_ == settings_.audioSettings_.separateStreams_;
+				settings_.audioSettings_.roundTripLatency_ = sameConfig ? prevSettings.roundTripLatency_ : 0;
 				settings_.Save();
 			}
 		}
@@ -263,6 +451,127 @@ namespace App
 
 				ImGui::Separator();
 
+				if(ImGui::CollapsingHeader("Performance"))
+				{
+					AudioStats stats;
+					audioBackend_.GetStats(stats);
+					ImGui::Text("CPU Load: %.1f%%", stats.cpuLoad_ * 100.0);
+					ImGui::Text("Blocks: %d (%d-%d frames)", stats.numBlocks_, stats.minFrames_, stats.maxFrames_);
+					ImGui::Text("Output Latency: %.2fms", stats.outputLatency_ * 1000.0);
+					ImGui::Text("Underflows: in %d, out %d", stats.inputUnderflows_, stats.outputUnderflows_);
+					ImGui::Text("Overflows: in %d, out %d", stats.inputOverflows_, stats.outputOverflows_);
+					if(settings_.audioSettings_.separateStreams_)
+					{
+						ImGui::Text("Bridge: ratio %.6f, latency %d frames", stats.bridgeRatio_, stats.bridgeLatency_);
+						ImGui::Text("Bridge: underruns %d, overruns %d", stats.bridgeUnderruns_, stats.bridgeOverruns_);
+					}
+
+					Core::Array<f32, AudioHistogram::NUM_BUCKETS> buckets;
+					auto plotHistogram = [&buckets](const char* name, const AudioHistogram& histogram)
+					{
+						for(i32 bucket = 0; bucket < AudioHistogram::NUM_BUCKETS; ++bucket)
+							buckets[bucket] = (f32)histogram.buckets_[bucket];
+
+						Core::String overlay;
+						overlay.Printf("%s: mean %.1f%%, max %.1f%%", name, histogram.GetMean() * 100.0f, histogram.max_ * 100.0f);
+						Gui::ScopedID scopedId(name);
+						ImGui::PlotHistogram("", buckets.data(), buckets.size(), 0, overlay.c_str(), 0.0f, FLT_MAX, ImVec2(0.0f, 48.0f));
+					};
+
+					plotHistogram("Total", stats.utilisation_);
+
+					Core::Vector<AudioCallbackStats> callbackStats;
+					audioBackend_.GetCallbackStats(callbackStats);
+					for(const auto& callback : callbackStats)
+						plotHistogram(callback.name_, callback.utilisation_);
+
+					if(ImGui::Button("Reset Stats"))
+						audioBackend_.ResetStats();
+
+					ImGui::Text("Sample Cache: %d sounds, %.1f MB", sampleCache_.GetNumEntries(), (f64)sampleCache_.GetUsage() / (1024.0 * 1024.0));
+					if(ImGui::SliderInt("Cache Budget (MB)", &settings_.sampleCacheMB_, 64, 4096))
+					{
+						sampleCache_.SetBudget((i64)settings_.sampleCacheMB_ * 1024 * 1024);
+						settings_.Save();
+					}
+				}
+
+				// Store measured latency so recording & playback can compensate for it.
+				if(audioLatencyCallback_->Update() &&
+					audioLatencyCallback_->GetState() == Callbacks::AudioLatencyCallback::State::DONE)
+				{
+					settings_.audioSettings_.roundTripLatency_ = audioLatencyCallback_->GetLatency();
+					settings_.Save();
+				}
+
+				if(ImGui::CollapsingHeader("Latency"))
+				{
+					f64 inputLatency = 0.0;
+					f64 outputLatency = 0.0;
+					audioBackend_.GetReportedLatency(inputLatency, outputLatency);
+					ImGui::Text("Reported: input %.2fms, output %.2fms, total %.2fms",
+						inputLatency * 1000.0, outputLatency * 1000.0, (inputLatency + outputLatency) * 1000.0);
+
+					const i32 roundTripLatency = settings_.audioSettings_.roundTripLatency_;
+					if(roundTripLatency > 0)
+						ImGui::Text("Measured: %d frames, %.2fms", roundTripLatency,
+							(f64)roundTripLatency * 1000.0 / (f64)settings_.audioSettings_.sampleRate_);
+					else
+						ImGui::Text("Measured: none");
+
+					switch(audioLatencyCallback_->GetState())
+					{
+					case Callbacks::AudioLatencyCallback::State::RUNNING:
+					case Callbacks::AudioLatencyCallback::State::CAPTURED:
+						ImGui::Text("Measuring...");
+						break;
+					case Callbacks::AudioLatencyCallback::State::DONE:
+						ImGui::Text("Last measurement: confidence %.1f", audioLatencyCallback_->GetConfidence());
+						break;
+					case Callbacks::AudioLatencyCallback::State::FAILED:
+						ImGui::TextColored(ImVec4(0.8f, 0.0f, 0.0f, 1.0f), "Measurement failed, loop an output back to input 1.");
+						break;
+					default:
+						break;
+					}
+
+					if(ImGui::Button("Measure Latency"))
+						audioLatencyCallback_->Start(settings_.audioSettings_.sampleRate_);
+				}
+
+#if RT_CHECK_ENABLED
+				if(ImGui::CollapsingHeader("Realtime Safety"))
+				{
+					bool rtCheckEnabled = RTCheck::IsEnabled();
+					if(ImGui::Checkbox("Enabled", &rtCheckEnabled))
+						RTCheck::SetEnabled(rtCheckEnabled);
+
+					Core::Array<RTCheck::Report, RTCheck::MAX_REPORTS> reports;
+					const i32 numReports = RTCheck::GetReports(reports.data(), reports.size());
+					if(numReports == 0)
+						ImGui::Text("No violations.");
+					for(i32 idx = 0; idx < numReports; ++idx)
+					{
+						const auto& report = reports[idx];
+						const char* callback = report.callback_ ? report.callback_ : "dispatch";
+						if(report.file_)
+							ImGui::TextColored(ImVec4(0.8f, 0.0f, 0.0f, 1.0f), "%s in %s at %s(%d): %d",
+								RTCheck::GetViolationName(report.violation_), callback, report.file_, report.line_, report.count_);
+						else
+							ImGui::TextColored(ImVec4(0.8f, 0.0f, 0.0f, 1.0f), "%s in %s from %p: %d",
+								RTCheck::GetViolationName(report.violation_), callback, report.address_, report.count_);
+					}
+
+					if(ImGui::Button("Log Violations"))
+						RTCheck::LogReports();
+					ImGui::SameLine();
+					if(ImGui::Button("Reset Violations"))
+						RTCheck::ResetReports();
+				}
+#endif
+
+				ImGui::Separator();
+
 				if(audioRecordingCallback_->IsRecording())
 				{
 					ImGui::TextColored(ImVec4(0.8f, 0.0f, 0.0f, 1.0f), "* RECORDING");
@@ -284,6 +593,25 @@ namespace App
 				Gui::SliderFloat("Stop Threshhold:", &stopThreshold, 0.0f, 1.0f);
 				audioRecordingCallback_->SetThresholdStop(stopThreshold);
 
+				const char* recordingModeStrs[] = { "Interleaved", "Per Track" };
+				i32 recordingMode = (i32)audioRecordingCallback_->GetMode();
+				if(Gui::Combo("Mode:", &recordingMode, recordingModeStrs, 2))
+					audioRecordingCallback_->SetMode((Callbacks::RecordingMode)recordingMode);
+
+				bool compressed = audioRecordingCallback_->GetCompressed();
+				if(ImGui::Checkbox("Lossless Compression", &compressed))
+					audioRecordingCallback_->SetCompressed(compressed);
+
+				f32 preRollTime = audioRecordingCallback_->GetPreRollTime();
+				if(Gui::SliderFloat("Pre-roll:", &preRollTime, 0.0f, 5.0f))
+					audioRecordingCallback_->SetPreRollTime(preRollTime);
+
+				const i32 numDroppedBlocks = audioRecordingCallback_->GetNumDroppedBlocks();
+				if(numDroppedBlocks > 0)
+					ImGui::TextColored(ImVec4(0.8f, 0.0f, 0.0f, 1.0f), "Disk buffer: %.1fs, dropped blocks: %d", audioRecordingCallback_->GetStallTolerance(), numDroppedBlocks);
+				else
+					ImGui::Text("Disk buffer: %.1fs, dropped blocks: 0", audioRecordingCallback_->GetStallTolerance());
+
 				if(ImGui::Button("Start Recording"))
 					audioRecordingCallback_->Start();
 				ImGui::SameLine();
@@ -296,45 +624,82 @@ namespace App
 				f32 countDownTimer = audioRecordingCallback_->RecordingTimeLeft();
 				ImGui::SliderFloat("", &countDownTimer, 0.0f, audioRecordingCallback_->GetTimeout());
 
-				Core::Vector<Core::String> fileNames;
-				auto recordingIds = audioRecordingCallback_->GetRecordingIDs();
-				for(auto id : recordingIds)
-				{
-					Core::String fileName;
-					fileName.Printf("audio_out_%08u.wav", id);
-					fileNames.push_back(fileName);
-				}
+				if(recordingCatalog_.Update())
+					FilterRecordings();
+				if(ImGui::InputText("Filter", recordingFilter_, sizeof(recordingFilter_)))
+					FilterRecordings();
 
-				if(fileNames.size() > 0)
+				if(filteredRecordings_.size() > 0)
 				{
 					ImGui::Columns(2);
 
-					static int selectedRecording = 0;
-					if(Gui::ListBox("Recordings:", &selectedRecording,
-						[](void* data, int idx, const char** out_text)
+					// Only visible rows are touched.
+					ImGui::BeginChild("Recordings", ImVec2(0.0f, 256.0f), true);
+					ImGuiListClipper clipper(filteredRecordings_.size());
+					while(clipper.Step())
 					{
-						const Core::Vector<Core::String>& fileNames = *static_cast<const Core::Vector<Core::String>*>(data);
-						if(idx >= fileNames.size())
-							return false;
-						*out_text = fileNames[idx].c_str();
-						return true;
-					}, &fileNames, fileNames.size(), 16))
-					{
-						audioPlaybackCallback_->Play(fileNames[selectedRecording].c_str());
+						for(i32 row = clipper.DisplayStart; row < clipper.DisplayEnd; ++row)
+						{
+							const i32 entryIdx = filteredRecordings_[row];
+							const RecordingEntry& entry = recordingCatalog_.GetEntry(entryIdx);
+							Core::Array<char, 256> label;
+							sprintf_s(label.data(), label.size(), "%s  %.1fs  %dch  %dHz  peak %.2f",
+								entry.fileName_, entry.GetDuration(), entry.numChannels_, entry.sampleRate_, entry.peak_);
+							if(ImGui::Selectable(label.data(), entryIdx == selectedRecording_))
+							{
+								selectedRecording_ = entryIdx;
+								audioPlaybackCallback_->Play(entry.fileName_);
+							}
+						}
 					}
-				
+					clipper.End();
+					ImGui::EndChild();
 
 					ImGui::NextColumn();
 
-					if(ImGui::Button("Play"))
+					const char* selectedFileName = selectedRecording_ >= 0 ? recordingCatalog_.GetEntry(selectedRecording_).fileName_ : nullptr;
+					if(ImGui::Button("Play") && selectedFileName)
 					{
-						audioPlaybackCallback_->Play(fileNames[selectedRecording].c_str());
+						audioPlaybackCallback_->Play(selectedFileName);
 					}
 					if(ImGui::Button("Stop"))
 					{
 						audioPlaybackCallback_->Stop();
 					}
 
+					if(audioPlaybackCallback_->IsPlaying())
+					{
+						const i32 sampleRate = Core::Max(audioPlaybackCallback_->GetSampleRate(), 1);
+						f32 position = (f32)audioPlaybackCallback_->GetPosition() / (f32)sampleRate;
+						const f32 length = (f32)audioPlaybackCallback_->GetNumFrames() / (f32)sampleRate;
+						if(ImGui::SliderFloat("Position", &position, 0.0f, length))
+							audioPlaybackCallback_->Seek((i64)((f64)position * sampleRate));
+						if(audioPlaybackCallback_->GetUnderruns() > 0)
+							ImGui::Text("Underruns: %d", audioPlaybackCallback_->GetUnderruns());
+					}
+
+					if(selectedFileName)
+						UpdatePeaks(selectedFileName);
+					if(peaks_ && peaks_->GetNumFrames() > 0)
+					{
+						// Whole take, or a window around the play position when zoomed.
+						static f32 waveformZoom = 1.0f;
+						Gui::SliderFloat("Zoom:", &waveformZoom, 1.0f, 256.0f);
+
+						const i64 numFrames = peaks_->GetNumFrames();
+						const i64 viewFrames = Core::Max((i64)(numFrames / waveformZoom), (i64)WAVEFORM_PEAKS);
+						i64 beginFrame = 0;
+						if(audioPlaybackCallback_->IsPlaying())
+							beginFrame = Core::Clamp((i64)audioPlaybackCallback_->GetPosition() - viewFrames / 2, (i64)0, Core::Max(numFrames - viewFrames, (i64)0));
+
+						Core::Array<Sound::Peak, WAVEFORM_PEAKS> peaks;
+						Core::Array<f32, WAVEFORM_PEAKS> values;
+						peaks_->GetPeaks(0, beginFrame, beginFrame + viewFrames, peaks.data(), peaks.size());
+						for(i32 idx = 0; idx < peaks.size(); ++idx)
+							values[idx] = Core::Max(peaks[idx].max_, -peaks[idx].min_);
+						ImGui::PlotHistogram("Waveform", values.data(), values.size(), 0, nullptr, 0.0f, 1.0f, ImVec2(0.0f, 64.0f));
+					}
+
 					ImGui::Columns(1);
 				}
 
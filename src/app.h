@@ -13,6 +13,7 @@ namespace App
 		static void SetSettings(const Settings& settings);
 
 	private:
+		static int RunHeadless(int argc, char* const argv[]);
 		static bool Initialize(int argc, char* const argv[]);
 		static void Finalize();
 		static bool Tick();
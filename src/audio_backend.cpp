@@ -2,40 +2,730 @@
 
 #include "core/array.h"
 #include "core/concurrency.h"
+#include "core/debug.h"
 #include "core/file.h"
 #include "core/misc.h"
+#include "core/timer.h"
 #include "core/vector.h"
 
 #include "ispc/clipping_ispc.h"
+#include "ispc/limiter_ispc.h"
+
+#include "audio_rt_check.h"
+#include "audio_stream_bridge.h"
+#include "sound.h"
 
 #include <portaudio.h>
 
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 #include <algorithm>
+#include <cmath>
+
+static int WorkerThread(void* userData);
 
 struct AudioBackendImpl
 {
 	Core::Vector<AudioDeviceInfo> inputDeviceInfos_;
 	Core::Vector<AudioDeviceInfo> outputDeviceInfos_;
 
+	/// Full duplex stream, or output stream when using separate streams.
 	PaStream* stream_ = nullptr;
+	/// Input stream when using separate streams.
+	PaStream* inStream_ = nullptr;
+	/// Latencies reported by the device when the stream was opened, in seconds.
+	f64 reportedInputLatency_ = 0.0;
+	f64 reportedOutputLatency_ = 0.0;
+
+	/// Bridge between input & output streams when using separate streams.
+	AudioStreamBridge* bridge_ = nullptr;
+	Core::Vector<f32> bridgeData_;
+	Core::Vector<f32*> bridgeIn_;
+	Core::Vector<f32*> bridgeOut_;
 
 	i32 inChannels_ = 0;
 	i32 outChannels_ = 0;
+	i32 sampleRate_ = 0;
+
+	/// Device stats, written by the audio thread.
+	AudioStats stats_;
 
 	struct Callback
 	{
 		IAudioCallback* callback_ = nullptr;
 		u32 inMask_ = 0;
 		u32 outMask_ = 0;
+		/// Callbacks which must complete before this one runs.
+		Core::Vector<IAudioCallback*> dependencies_;
+		/// Timings, owned by the registry. Freed once the audio thread can no longer see it.
+		AudioCallbackStats* stats_ = nullptr;
+	};
+
+	/// Maximum number of channels addressable by callback masks.
+	static const i32 MAX_CHANNELS = 32;
+
+	/// Callback with its channel masks compiled down to channel indices.
+	/// Routes form the nodes of the processing graph.
+	struct Route
+	{
+		IAudioCallback* callback_ = nullptr;
+		AudioCallbackStats* stats_ = nullptr;
+		i32 numIn_ = 0;
+		i32 numOut_ = 0;
+		/// Offset of first channel index in CallbackList::inChannels_.
+		i32 inOffset_ = 0;
+		/// Offset of first channel index in CallbackList::outChannels_.
+		i32 outOffset_ = 0;
+		/// Number of routes which must complete before this one.
+		i32 numDependencies_ = 0;
+		/// Offset of first successor in CallbackList::successors_.
+		i32 successorOffset_ = 0;
+		i32 numSuccessors_ = 0;
 	};
 
+	/// Immutable snapshot of registered callbacks, published to the audio thread.
+	/// Routes are stored in topological order.
+	struct CallbackList
+	{
+		Core::Vector<Route> routes_;
+		/// Device input channel indices for all routes.
+		Core::Vector<i32> inChannels_;
+		/// Device output channel indices for all routes.
+		Core::Vector<i32> outChannels_;
+		/// Route indices which depend on each route.
+		Core::Vector<i32> successors_;
+		/// Maximum number of routes which can execute concurrently.
+		i32 maxParallelism_ = 1;
+		/// Value of @a epoch_ at the point this list was replaced.
+		i32 retiredEpoch_ = 0;
+
+		/// Per-block scratch, only touched whilst processing a block.
+		mutable Core::Vector<const f32*> inStreams_;
+		mutable Core::Vector<f32*> outStreams_;
+		/// Outstanding dependencies per route for the current block.
+		/// Whoever drops it to 0 pushes the route to @a ready_.
+		mutable Core::Vector<i32> pending_;
+		/// Routes of the current block in the order they became ready, -1 for slots not pushed yet.
+		mutable Core::Vector<i32> ready_;
+	};
+
+	/// Maximum number of worker threads processing the graph.
+	static const i32 MAX_WORKERS = 8;
+	/// Layout of @a claim_: generation, number of routes & next ready slot to claim.
+	/// The generation only has to make claims read before a block closed fail. A claim that passes after
+	/// it wraps is still a valid claim of the same slot in the current block, as everything else it
+	/// uses is read after claiming.
+	static const i32 CLAIM_INDEX_MASK = 0x3ff;
+	static const i32 CLAIM_COUNT_SHIFT = 10;
+	static const i32 CLAIM_GENERATION_SHIFT = 20;
+	static const i32 CLAIM_GENERATION_MASK = 0x7ff;
+	/// Unsuccessful attempts a worker makes to claim a ready route before going back to sleep.
+	static const i32 WORKER_SPINS = 256;
+	/// Maximum number of routes in a graph, limited by @a claim_.
+	static const i32 MAX_ROUTES = CLAIM_INDEX_MASK;
+
+	/// Serialises writers. Never taken on the audio thread.
 	Core::Mutex callbackMutex_;
+	/// Writer side copy of callbacks, used to build new snapshots.
 	Core::Vector<Callback> callbacks_;
+	/// Snapshot currently visible to the audio thread.
+	CallbackList* volatile publishedList_ = nullptr;
+	/// Snapshots that have been replaced but may still be in use by the audio thread.
+	Core::Vector<CallbackList*> retiredLists_;
+	/// Incremented on entry & exit of the stream callback, so is odd whilst a block is being processed.
+	volatile i32 epoch_ = 0;
+
+	/// Worker threads used to run independent routes in parallel.
+	Core::Vector<Core::Thread> workers_;
+	Core::Semaphore workerSem_{0, 0x7fff, "Audio Workers"};
+	volatile i32 workersExit_ = 0;
+
+	/// Current block being processed by the graph.
+	const CallbackList* volatile blockList_ = nullptr;
+	const f32* const* volatile blockIn_ = nullptr;
+	f32** volatile blockOut_ = nullptr;
+	volatile i32 blockFrames_ = 0;
+	/// Duration of the current block in seconds.
+	volatile f64 blockDeadline_ = 0.0;
+	/// Ready slots of the current block left to claim, packed with the block generation so a claim
+	/// based on a stale read fails rather than landing in the next block. No routes whilst closed.
+	volatile i32 claim_ = 0;
+	/// Number of slots of the current block's ready list that have been reserved.
+	volatile i32 numReady_ = 0;
+	/// Generation of the current block, only touched by the audio thread.
+	i32 blockGeneration_ = 0;
+	/// Number of routes completed in the current block.
+	volatile i32 completedRoutes_ = 0;
+
+	/// Fixed processing quantum, 0 to process whatever the device provides.
+	i32 quantum_ = 0;
+	/// Host blocks are always a multiple of the quantum, so can be sliced without buffering.
+	bool quantumDirect_ = false;
+	/// Frames accumulated towards the next quantum when buffering.
+	i32 quantumFill_ = 0;
+	Core::Vector<f32> quantumData_;
+	Core::Vector<f32*> quantumIn_;
+	Core::Vector<f32*> quantumOut_;
+	Core::Vector<const f32*> quantumSliceIn_;
+	Core::Vector<f32*> quantumSliceOut_;
+
+	/// Output stage.
+	AudioOutputStage outputStage_ = AudioOutputStage::HARD_CLIP;
+	ispc::LimiterState limiterState_;
+	i32 limiterMaxFrames_ = 0;
+	Core::Vector<f32> limiterBuffers_;
+	Core::Vector<i32> limiterDequeIdx_;
+	Core::Vector<f32> limiterScratch_;
+	Core::Vector<f32*> limiterChannels_;
+
+	/// Headless device.
+	AudioHeadlessSettings headlessSettings_;
+	Core::Array<char, Core::MAX_PATH_LENGTH> headlessInputFile_;
+	Core::Array<char, Core::MAX_PATH_LENGTH> headlessOutputFile_;
+	Core::Thread headlessThread_;
+	volatile i32 headlessRunning_ = 0;
+	volatile i32 headlessStop_ = 0;
+
+	~AudioBackendImpl()
+	{
+		StopWorkers();
+		for(auto& callback : callbacks_)
+			delete callback.stats_;
+		delete publishedList_;
+		for(auto* list : retiredLists_)
+			delete list;
+	}
+
+	/**
+	 * Setup output stage for the current device, preallocating everything the limiter needs.
+	 * @pre Device is stopped, and channel counts & sample rate are set.
+	 */
+	void PrepareOutputStage(const AudioDeviceSettings& settings, i32 maxFrames)
+	{
+		outputStage_ = settings.outputStage_;
+		if(outputStage_ == AudioOutputStage::LIMITER)
+		{
+			const i32 lookahead = Core::Max(1, (i32)(settings.limiterLookaheadMs_ * 0.001f * sampleRate_));
+			const f32 release = 1.0f - std::exp(-1.0f / Core::Max(1.0f, settings.limiterReleaseMs_ * 0.001f * sampleRate_));
+			limiterState_ = ispc::limiter_state(lookahead, settings.limiterCeiling_, release);
+			limiterMaxFrames_ = maxFrames;
+
+			// Box filter starts at unity gain, delay lines silent.
+			limiterBuffers_.clear();
+			limiterBuffers_.resize(lookahead * 2 + 1 + lookahead * outChannels_, 0.0f);
+			std::fill(limiterBuffers_.begin(), limiterBuffers_.begin() + lookahead, 1.0f);
+			limiterDequeIdx_.clear();
+			limiterDequeIdx_.resize(lookahead + 1, 0);
+			limiterScratch_.resize(maxFrames * 2 + lookahead);
+			limiterChannels_.resize(outChannels_);
+		}
+	}
+
+	void ProcessOutputStage(f32** fout, i32 frameCount)
+	{
+		switch(outputStage_)
+		{
+		case AudioOutputStage::HARD_CLIP:
+			for(i32 out = 0; out < outChannels_; ++out)
+				ispc::clipping_hard(fout[out], fout[out], frameCount);
+			break;
+
+		case AudioOutputStage::SOFT_CLIP:
+			for(i32 out = 0; out < outChannels_; ++out)
+				ispc::clipping_soft(fout[out], fout[out], frameCount);
+			break;
+
+		case AudioOutputStage::LIMITER:
+			for(i32 offset = 0; offset < frameCount; offset += limiterMaxFrames_)
+			{
+				const i32 numFrames = Core::Min(limiterMaxFrames_, frameCount - offset);
+				for(i32 out = 0; out < outChannels_; ++out)
+					limiterChannels_[out] = fout[out] + offset;
+				ispc::limiter_process(&limiterState_, limiterChannels_.data(), outChannels_, numFrames,
+					limiterBuffers_.data(), limiterDequeIdx_.data(), limiterScratch_.data());
+			}
+			break;
+		}
+	}
+
+	/**
+	 * Setup fixed processing quantum.
+	 * @param hostFrames Frames per host block, or 0 if the host may vary it.
+	 * @pre Device is stopped, and channel counts are set.
+	 */
+	void PrepareQuantum(i32 quantum, i32 hostFrames)
+	{
+		quantum_ = quantum;
+		quantumDirect_ = hostFrames > 0 && quantum > 0 && (hostFrames % quantum) == 0;
+		quantumFill_ = 0;
+
+		quantumData_.clear();
+		quantumData_.resize((inChannels_ + outChannels_) * quantum, 0.0f);
+		quantumIn_.resize(inChannels_);
+		quantumOut_.resize(outChannels_);
+		for(i32 in = 0; in < inChannels_; ++in)
+			quantumIn_[in] = quantumData_.data() + in * quantum;
+		for(i32 out = 0; out < outChannels_; ++out)
+			quantumOut_[out] = quantumData_.data() + (inChannels_ + out) * quantum;
+		quantumSliceIn_.resize(inChannels_);
+		quantumSliceOut_.resize(outChannels_);
+	}
+
+	void StartWorkers(i32 numWorkers)
+	{
+		StopWorkers();
+		numWorkers = Core::Min(numWorkers, MAX_WORKERS);
+		for(i32 idx = 0; idx < numWorkers; ++idx)
+			workers_.emplace_back(WorkerThread, this, Core::Thread::DEFAULT_STACK_SIZE, "Audio Worker");
+	}
+
+	void StopWorkers()
+	{
+		if(workers_.size() > 0)
+		{
+			Core::AtomicExchg(&workersExit_, 1);
+			workerSem_.Signal(workers_.size());
+			for(auto& worker : workers_)
+				worker.Join();
+			workers_.clear();
+			workersExit_ = 0;
+		}
+	}
+
+	/**
+	 * Is @a list no longer reachable from the audio thread?
+	 */
+	bool IsRetiredListFree(const CallbackList* list) const
+	{
+		const i32 epoch = epoch_;
+		return (list->retiredEpoch_ & 1) == 0 || epoch != list->retiredEpoch_;
+	}
+
+	/**
+	 * Free retired snapshots the audio thread can no longer see.
+	 * @param wait Block until all retired snapshots can be freed.
+	 * @pre callbackMutex_ is held.
+	 */
+	void ReclaimRetiredLists(bool wait)
+	{
+		for(i32 idx = 0; idx < retiredLists_.size();)
+		{
+			auto* list = retiredLists_[idx];
+			if(wait)
+			{
+				while(!IsRetiredListFree(list))
+					Core::Sleep(0.0001);
+			}
+
+			if(IsRetiredListFree(list))
+			{
+				delete list;
+				retiredLists_.erase(retiredLists_.begin() + idx);
+			}
+			else
+			{
+				++idx;
+			}
+		}
+	}
+
+	/**
+	 * Resolve callback masks against the current device channel counts, and
+	 * build the processing graph from declared & implicit dependencies.
+	 * Callbacks which write to the same output channel are ordered by registration,
+	 * as outputs are accumulated into.
+	 * @return false if dependencies contain a cycle, or there are more than MAX_ROUTES callbacks.
+	 * @pre callbackMutex_ is held.
+	 */
+	bool CompileRoutes(CallbackList& list) const
+	{
+		const i32 inChannels = Core::Min(inChannels_, MAX_CHANNELS);
+		const i32 outChannels = Core::Min(outChannels_, MAX_CHANNELS);
+		const i32 numCallbacks = callbacks_.size();
+		if(numCallbacks > MAX_ROUTES)
+			return false;
+
+		// Gather edges in registration order.
+		Core::Vector<Core::Vector<i32>> edges(numCallbacks);
+		Core::Vector<i32> numDependencies(numCallbacks, 0);
+		for(i32 idx = 0; idx < numCallbacks; ++idx)
+		{
+			const auto& callback = callbacks_[idx];
+			for(i32 depIdx = 0; depIdx < numCallbacks; ++depIdx)
+			{
+				if(depIdx == idx)
+					continue;
+
+				const auto& dep = callbacks_[depIdx];
+				const bool isDeclared = std::find(callback.dependencies_.begin(), callback.dependencies_.end(), dep.callback_) != callback.dependencies_.end();
+				const bool isOutputShared = depIdx < idx && (dep.outMask_ & callback.outMask_) != 0;
+				if(isDeclared || isOutputShared)
+				{
+					edges[depIdx].push_back(idx);
+					numDependencies[idx]++;
+				}
+			}
+		}
+
+		// Topological sort, preferring registration order. Track depth to determine parallelism.
+		Core::Vector<i32> order;
+		Core::Vector<i32> depth(numCallbacks, 0);
+		Core::Vector<i32> remaining = numDependencies;
+		order.reserve(numCallbacks);
+		while(order.size() < numCallbacks)
+		{
+			i32 next = -1;
+			for(i32 idx = 0; idx < numCallbacks; ++idx)
+			{
+				if(remaining[idx] == 0)
+				{
+					next = idx;
+					break;
+				}
+			}
+			if(next < 0)
+				return false;
+
+			remaining[next] = -1;
+			order.push_back(next);
+			for(i32 succ : edges[next])
+			{
+				remaining[succ]--;
+				depth[succ] = Core::Max(depth[succ], depth[next] + 1);
+			}
+		}
+
+		Core::Vector<i32> routeIdx(numCallbacks);
+		for(i32 idx = 0; idx < numCallbacks; ++idx)
+			routeIdx[order[idx]] = idx;
+
+		Core::Vector<i32> depthWidth(numCallbacks + 1, 0);
+		list.routes_.reserve(numCallbacks);
+		for(i32 callbackIdx : order)
+		{
+			const auto& callback = callbacks_[callbackIdx];
+
+			Route route;
+			route.callback_ = callback.callback_;
+			route.stats_ = callback.stats_;
+			route.inOffset_ = list.inChannels_.size();
+			route.outOffset_ = list.outChannels_.size();
+			route.numDependencies_ = numDependencies[callbackIdx];
+			route.successorOffset_ = list.successors_.size();
+			route.numSuccessors_ = edges[callbackIdx].size();
+			for(i32 succ : edges[callbackIdx])
+				list.successors_.push_back(routeIdx[succ]);
+
+			for(i32 in = 0; in < inChannels; ++in)
+			{
+				if(Core::ContainsAllFlags(callback.inMask_, (1u << in)))
+				{
+					list.inChannels_.push_back(in);
+					route.numIn_++;
+				}
+			}
+
+			for(i32 out = 0; out < outChannels; ++out)
+			{
+				if(Core::ContainsAllFlags(callback.outMask_, (1u << out)))
+				{
+					list.outChannels_.push_back(out);
+					route.numOut_++;
+				}
+			}
 
-	Core::Vector<const f32*> inStreams_;
-	Core::Vector<f32*> outStreams_;
+			list.routes_.push_back(route);
+			list.maxParallelism_ = Core::Max(list.maxParallelism_, ++depthWidth[depth[callbackIdx]]);
+		}
+
+		list.inStreams_.resize(list.inChannels_.size());
+		list.outStreams_.resize(list.outChannels_.size());
+		list.pending_.resize(list.routes_.size());
+		list.ready_.resize(list.routes_.size());
+		return true;
+	}
+
+	/**
+	 * Build a new snapshot from @a callbacks_ and publish it to the audio thread.
+	 * @pre callbackMutex_ is held.
+	 */
+	bool PublishCallbacks()
+	{
+		auto* list = new CallbackList();
+		if(!CompileRoutes(*list))
+		{
+			delete list;
+			return false;
+		}
+
+		auto* oldList = static_cast<CallbackList*>(Core::AtomicExchgPtr((void* volatile*)&publishedList_, list));
+		if(oldList)
+		{
+			oldList->retiredEpoch_ = epoch_;
+			retiredLists_.push_back(oldList);
+		}
+		return true;
+	}
 };
 
+/**
+ * Raise the calling thread to realtime priority, so workers aren't preempted mid-block by normal threads.
+ * Without permission this fails & workers stay at normal priority.
+ */
+static void SetRealtimePriority()
+{
+#if defined(_WIN32)
+	::SetThreadPriority(::GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+#else
+	sched_param param = {};
+	param.sched_priority = sched_get_priority_max(SCHED_FIFO) - 1;
+	pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+#endif
+}
+
+/**
+ * Run a single route of the current block, once its dependencies have completed.
+ */
+static void RunRoute(AudioBackendImpl* impl_, const AudioBackendImpl::CallbackList* list, i32 idx)
+{
+	const auto& route = list->routes_[idx];
+
+	const f32* const* fin = impl_->blockIn_;
+	f32** fout = impl_->blockOut_;
+	const f32** inStreams = list->inStreams_.data() + route.inOffset_;
+	f32** outStreams = list->outStreams_.data() + route.outOffset_;
+	for(i32 in = 0; in < route.numIn_; ++in)
+		inStreams[in] = fin[list->inChannels_[route.inOffset_ + in]];
+	for(i32 out = 0; out < route.numOut_; ++out)
+		outStreams[out] = fout[list->outChannels_[route.outOffset_ + out]];
+
+	RT_CHECK_SCOPED_CALLBACK(route.callback_->GetName());
+	const f64 beginTime = Core::Timer::GetAbsoluteTime();
+	route.callback_->OnAudioCallback(route.numIn_, route.numOut_, inStreams, outStreams, impl_->blockFrames_);
+	const f64 endTime = Core::Timer::GetAbsoluteTime();
+	route.stats_->utilisation_.Add((f32)((endTime - beginTime) / impl_->blockDeadline_));
+
+	// Successors whose last dependency this was become claimable by any thread, rather than all running here.
+	for(i32 succ = 0; succ < route.numSuccessors_; ++succ)
+	{
+		const i32 succIdx = list->successors_[route.successorOffset_ + succ];
+		if(Core::AtomicDec(&list->pending_[succIdx]) == 0)
+		{
+			const i32 slot = Core::AtomicInc(&impl_->numReady_) - 1;
+			Core::AtomicExchg(&list->ready_[slot], succIdx);
+		}
+	}
+
+	// Last access to the list, the block may complete & the list be freed after this.
+	Core::AtomicInc(&impl_->completedRoutes_);
+}
+
+/**
+ * Claim & run the next ready route of the current block.
+ * @return false if no route was ready, or all have been claimed.
+ */
+static bool RunReadyRoute(AudioBackendImpl* impl_)
+{
+	for(;;)
+	{
+		// Only the claim word & impl members are read before claiming, as the list may be stale.
+		const i32 claim = impl_->claim_;
+		const i32 slot = claim & AudioBackendImpl::CLAIM_INDEX_MASK;
+		const i32 numRoutes = (claim >> AudioBackendImpl::CLAIM_COUNT_SHIFT) & AudioBackendImpl::CLAIM_INDEX_MASK;
+		if(slot >= numRoutes || slot >= impl_->numReady_)
+			return false;
+
+		if(Core::AtomicCmpExchg(&impl_->claim_, claim + 1, claim) != claim)
+		{
+			Core::YieldCPU();
+			continue;
+		}
+
+		// The block can't complete until this route has run, so the list stays valid. The slot is
+		// reserved but may not be written yet. Slots are claimed in order, so its pusher is already running.
+		const auto* list = impl_->blockList_;
+		const volatile i32* ready = list->ready_.data();
+		i32 idx = -1;
+		while((idx = ready[slot]) < 0)
+			Core::YieldCPU();
+		RunRoute(impl_, list, idx);
+		return true;
+	}
+}
+
+static bool HasUnclaimedRoutes(AudioBackendImpl* impl_)
+{
+	const i32 claim = impl_->claim_;
+	return (claim & AudioBackendImpl::CLAIM_INDEX_MASK) < ((claim >> AudioBackendImpl::CLAIM_COUNT_SHIFT) & AudioBackendImpl::CLAIM_INDEX_MASK);
+}
+
+static int WorkerThread(void* userData)
+{
+	AudioBackendImpl* impl_ = (AudioBackendImpl*)userData;
+	SetRealtimePriority();
+	for(;;)
+	{
+		impl_->workerSem_.Wait();
+		if(impl_->workersExit_)
+			break;
+
+		// May wake after the block has already been completed, in which case there's nothing to claim.
+		// Give up after a bounded spin, the audio thread runs whatever is left.
+		RT_CHECK_SCOPED_REALTIME();
+		i32 numSpins = 0;
+		while(HasUnclaimedRoutes(impl_) && numSpins < AudioBackendImpl::WORKER_SPINS)
+		{
+			if(RunReadyRoute(impl_))
+				numSpins = 0;
+			else
+			{
+				++numSpins;
+				Core::YieldCPU();
+			}
+		}
+	}
+	return 0;
+}
+
+/**
+ * Run all registered callbacks over a block of non-interleaved audio.
+ * Shared by all device types so they exercise the same realtime path.
+ */
+static void DispatchCallbacks(AudioBackendImpl* impl_, const f32* const* fin, f32** fout, i32 frameCount)
+{
+	RT_CHECK_SCOPED_REALTIME();
+	const f64 beginTime = Core::Timer::GetAbsoluteTime();
+	const f64 blockDeadline = (f64)frameCount / (f64)impl_->sampleRate_;
+
+	// Mark block as in flight, then pick up the latest snapshot. Writers won't free it until we're done.
+	Core::AtomicInc(&impl_->epoch_);
+	const auto* callbackList = impl_->publishedList_;
+	if(callbackList && callbackList->routes_.size() > 0)
+	{
+		const i32 numRoutes = callbackList->routes_.size();
+		i32 numReady = 0;
+		for(i32 idx = 0; idx < numRoutes; ++idx)
+		{
+			const i32 numDependencies = callbackList->routes_[idx].numDependencies_;
+			callbackList->pending_[idx] = numDependencies;
+			callbackList->ready_[idx] = -1;
+			if(numDependencies == 0)
+				callbackList->ready_[numReady++] = idx;
+		}
+
+		impl_->blockList_ = callbackList;
+		impl_->blockIn_ = fin;
+		impl_->blockOut_ = fout;
+		impl_->blockFrames_ = frameCount;
+		impl_->blockDeadline_ = blockDeadline;
+		impl_->completedRoutes_ = 0;
+		impl_->numReady_ = numReady;
+
+		// Open the block, wake only as many workers as the graph can use, and help out.
+		const i32 generation = impl_->blockGeneration_ = (impl_->blockGeneration_ + 1) & AudioBackendImpl::CLAIM_GENERATION_MASK;
+		Core::AtomicExchg(&impl_->claim_, (generation << AudioBackendImpl::CLAIM_GENERATION_SHIFT) | (numRoutes << AudioBackendImpl::CLAIM_COUNT_SHIFT));
+		const i32 numWorkers = Core::Min(impl_->workers_.size(), callbackList->maxParallelism_ - 1);
+		if(numWorkers > 0)
+		{
+			RT_CHECK_SCOPED_ALLOW();
+			impl_->workerSem_.Signal(numWorkers);
+		}
+
+		// Run ready routes until all have completed. Spinning is only for routes already running on
+		// workers, & is bounded by the block's duration. Past that a worker may have been preempted,
+		// so give up the core rather than spin against it.
+		bool overran = false;
+		while(impl_->completedRoutes_ < numRoutes)
+		{
+			if(RunReadyRoute(impl_))
+				continue;
+			if(overran || Core::Timer::GetAbsoluteTime() - beginTime > blockDeadline)
+			{
+				if(!overran)
+					RT_CHECK(WAIT);
+				overran = true;
+				Core::Sleep(0.0);
+			}
+			else
+				Core::YieldCPU();
+		}
+		Core::AtomicExchg(&impl_->claim_, generation << AudioBackendImpl::CLAIM_GENERATION_SHIFT);
+	}
+	Core::AtomicInc(&impl_->epoch_);
+
+	// Keep outputs in range.
+	impl_->ProcessOutputStage(fout, frameCount);
+
+	auto& stats = impl_->stats_;
+	stats.utilisation_.Add((f32)((Core::Timer::GetAbsoluteTime() - beginTime) / blockDeadline));
+	if(stats.numBlocks_ == 0 || frameCount < stats.minFrames_)
+		stats.minFrames_ = frameCount;
+	if(frameCount > stats.maxFrames_)
+		stats.maxFrames_ = frameCount;
+	stats.numBlocks_ = stats.numBlocks_ + 1;
+}
+
+/**
+ * Run callbacks over a host block in fixed size quanta.
+ * Host blocks which are a multiple of the quantum are sliced in place. Otherwise
+ * frames are accumulated into whole quanta, adding one quantum of latency.
+ */
+static void ProcessBlock(AudioBackendImpl* impl_, const f32* const* fin, f32** fout, i32 frameCount)
+{
+	const i32 quantum = impl_->quantum_;
+	const i32 inChannels = impl_->inChannels_;
+	const i32 outChannels = impl_->outChannels_;
+	if(quantum <= 0)
+	{
+		DispatchCallbacks(impl_, fin, fout, frameCount);
+	}
+	else if(impl_->quantumDirect_)
+	{
+		const f32** sliceIn = impl_->quantumSliceIn_.data();
+		f32** sliceOut = impl_->quantumSliceOut_.data();
+		for(i32 offset = 0; offset < frameCount; offset += quantum)
+		{
+			for(i32 in = 0; in < inChannels; ++in)
+				sliceIn[in] = fin[in] + offset;
+			for(i32 out = 0; out < outChannels; ++out)
+				sliceOut[out] = fout[out] + offset;
+			DispatchCallbacks(impl_, sliceIn, sliceOut, Core::Min(quantum, frameCount - offset));
+		}
+	}
+	else
+	{
+		f32** quantumIn = impl_->quantumIn_.data();
+		f32** quantumOut = impl_->quantumOut_.data();
+		for(i32 offset = 0; offset < frameCount;)
+		{
+			// Input goes into the pending quantum, output comes from the last completed one.
+			const i32 fill = impl_->quantumFill_;
+			const i32 numFrames = Core::Min(frameCount - offset, quantum - fill);
+			for(i32 in = 0; in < inChannels; ++in)
+				memcpy(quantumIn[in] + fill, fin[in] + offset, sizeof(f32) * numFrames);
+			for(i32 out = 0; out < outChannels; ++out)
+				memcpy(fout[out] + offset, quantumOut[out] + fill, sizeof(f32) * numFrames);
+
+			offset += numFrames;
+			impl_->quantumFill_ = fill + numFrames;
+			if(impl_->quantumFill_ == quantum)
+			{
+				for(i32 out = 0; out < outChannels; ++out)
+					memset(quantumOut[out], 0, sizeof(f32) * quantum);
+				DispatchCallbacks(impl_, quantumIn, quantumOut, quantum);
+				impl_->quantumFill_ = 0;
+			}
+		}
+	}
+}
+
 static int StaticStreamCallback(
 	const void *input, void *output,
 	unsigned long frameCount,
@@ -43,44 +733,281 @@ static int StaticStreamCallback(
 	PaStreamCallbackFlags statusFlags,
 	void *userData )
 {
+	RT_CHECK_SCOPED_REALTIME();
 	AudioBackendImpl* impl_ = (AudioBackendImpl*)userData;
 	const f32* const* fin = reinterpret_cast<const f32* const*>(input);
 	f32** fout = reinterpret_cast<f32**>(output);
 
-	const i32 inChannels = impl_->inChannels_;
+	auto& stats = impl_->stats_;
+	if(statusFlags & paInputUnderflow)
+		stats.inputUnderflows_ = stats.inputUnderflows_ + 1;
+	if(statusFlags & paInputOverflow)
+		stats.inputOverflows_ = stats.inputOverflows_ + 1;
+	if(statusFlags & paOutputUnderflow)
+		stats.outputUnderflows_ = stats.outputUnderflows_ + 1;
+	if(statusFlags & paOutputOverflow)
+		stats.outputOverflows_ = stats.outputOverflows_ + 1;
+	if(statusFlags & paPrimingOutput)
+		stats.outputPriming_ = stats.outputPriming_ + 1;
+	if(timeInfo && timeInfo->outputBufferDacTime > 0.0)
+		stats.outputLatency_ = timeInfo->outputBufferDacTime - timeInfo->currentTime;
+
+	ProcessBlock(impl_, fin, fout, (i32)frameCount);
+
+	return paContinue;
+}
+
+/**
+ * Input half of separate streams. Queues input into the bridge.
+ */
+static int StaticInputStreamCallback(
+	const void *input, void *output,
+	unsigned long frameCount,
+	const PaStreamCallbackTimeInfo* timeInfo,
+	PaStreamCallbackFlags statusFlags,
+	void *userData )
+{
+	RT_CHECK_SCOPED_REALTIME();
+	AudioBackendImpl* impl_ = (AudioBackendImpl*)userData;
+	const f32* const* fin = reinterpret_cast<const f32* const*>(input);
+
+	auto& stats = impl_->stats_;
+	if(statusFlags & paInputUnderflow)
+		stats.inputUnderflows_ = stats.inputUnderflows_ + 1;
+	if(statusFlags & paInputOverflow)
+		stats.inputOverflows_ = stats.inputOverflows_ + 1;
+
+	impl_->bridge_->Write(fin, (i32)frameCount);
+
+	return paContinue;
+}
+
+/**
+ * Output half of separate streams. Pulls drift compensated input from the bridge and dispatches.
+ */
+static int StaticOutputStreamCallback(
+	const void *input, void *output,
+	unsigned long frameCount,
+	const PaStreamCallbackTimeInfo* timeInfo,
+	PaStreamCallbackFlags statusFlags,
+	void *userData )
+{
+	RT_CHECK_SCOPED_REALTIME();
+	AudioBackendImpl* impl_ = (AudioBackendImpl*)userData;
+	f32** fout = reinterpret_cast<f32**>(output);
+
+	auto& stats = impl_->stats_;
+	if(statusFlags & paOutputUnderflow)
+		stats.outputUnderflows_ = stats.outputUnderflows_ + 1;
+	if(statusFlags & paOutputOverflow)
+		stats.outputOverflows_ = stats.outputOverflows_ + 1;
+	if(statusFlags & paPrimingOutput)
+		stats.outputPriming_ = stats.outputPriming_ + 1;
+	if(timeInfo && timeInfo->outputBufferDacTime > 0.0)
+		stats.outputLatency_ = timeInfo->outputBufferDacTime - timeInfo->currentTime;
+
+	auto* bridge = impl_->bridge_;
 	const i32 outChannels = impl_->outChannels_;
+	f32** bridgeOut = impl_->bridgeOut_.data();
+	for(i32 offset = 0; offset < (i32)frameCount; offset += bridge->GetMaxFrames())
+	{
+		const i32 numFrames = Core::Min(bridge->GetMaxFrames(), (i32)frameCount - offset);
+		for(i32 out = 0; out < outChannels; ++out)
+			bridgeOut[out] = fout[out] + offset;
 
-	Core::ScopedMutex lock(impl_->callbackMutex_);
-	for(const auto& callback : impl_->callbacks_)
+		bridge->Read(impl_->bridgeIn_.data(), numFrames);
+		ProcessBlock(impl_, impl_->bridgeIn_.data(), bridgeOut, numFrames);
+	}
+
+	return paContinue;
+}
+
+/**
+ * Headless input source.
+ * Generates non-interleaved input blocks from a signal generator or sound file.
+ */
+class HeadlessSource
+{
+public:
+	HeadlessSource(const AudioHeadlessSettings& settings)
+		: settings_(settings)
 	{
-		i32 callbackIn = 0;
-		for(i32 in = 0; in < inChannels; ++in)
+		if(settings_.source_ == AudioHeadlessSource::FILE && settings_.inputFile_)
 		{
-			if(Core::ContainsAllFlags(callback.inMask_, (1 << in)))
+			auto file = Core::File(settings_.inputFile_, Core::FileFlags::READ);
+			if(file)
 			{
-				impl_->inStreams_[callbackIn++] = fin[in];
+				soundData_ = Sound::Load(file);
+				if(soundData_ && soundData_.sampleRate_ != settings_.sampleRate_)
+					soundData_ = Sound::Resample(soundData_, settings_.sampleRate_);
+				else if(soundData_.format_ != Sound::Format::F32)
+					soundData_ = Sound::Convert(soundData_, Sound::Format::F32);
 			}
 		}
+	}
 
-		i32 callbackOut = 0;
-		for(i32 out = 0; out < outChannels; ++out)
+	/**
+	 * Total number of frames to generate, or -1 if unbounded.
+	 */
+	i64 GetTotalFrames() const
+	{
+		if(settings_.duration_ > 0.0)
+			return (i64)(settings_.duration_ * settings_.sampleRate_);
+		if(settings_.source_ == AudioHeadlessSource::FILE)
+			return soundData_ ? soundData_.numSamples_ : 0;
+		return -1;
+	}
+
+	void Generate(f32** in, i32 numIn, i32 numFrames)
+	{
+		switch(settings_.source_)
 		{
-			if(Core::ContainsAllFlags(callback.outMask_, (1 << out)))
+		case AudioHeadlessSource::SILENCE:
+			for(i32 ch = 0; ch < numIn; ++ch)
+				memset(in[ch], 0, sizeof(f32) * numFrames);
+			break;
+
+		case AudioHeadlessSource::SINE:
 			{
-				impl_->outStreams_[callbackOut++] = fout[out];
+				const f64 step = (2.0 * 3.14159265358979323846 * settings_.frequency_) / settings_.sampleRate_;
+				for(i32 i = 0; i < numFrames; ++i)
+				{
+					const f32 value = (f32)std::sin(phase_) * settings_.amplitude_;
+					phase_ += step;
+					for(i32 ch = 0; ch < numIn; ++ch)
+						in[ch][i] = value;
+				}
+				phase_ = std::fmod(phase_, 2.0 * 3.14159265358979323846);
 			}
+			break;
+
+		case AudioHeadlessSource::NOISE:
+			for(i32 ch = 0; ch < numIn; ++ch)
+			{
+				for(i32 i = 0; i < numFrames; ++i)
+				{
+					noiseSeed_ = noiseSeed_ * 1664525u + 1013904223u;
+					in[ch][i] = (((f32)(noiseSeed_ >> 8) / (f32)(1 << 24)) * 2.0f - 1.0f) * settings_.amplitude_;
+				}
+			}
+			break;
+
+		case AudioHeadlessSource::FILE:
+			GenerateFromFile(in, numIn, numFrames);
+			break;
 		}
+	}
 
-		callback.callback_->OnAudioCallback(callbackIn, callbackOut, impl_->inStreams_.data(), impl_->outStreams_.data(), frameCount);
+private:
+	void GenerateFromFile(f32** in, i32 numIn, i32 numFrames)
+	{
+		const i32 numChannels = soundData_.numChannels_;
+		const i64 numSamples = soundData_.numSamples_;
+		if(!soundData_ || numChannels <= 0 || numSamples <= 0)
+		{
+			for(i32 ch = 0; ch < numIn; ++ch)
+				memset(in[ch], 0, sizeof(f32) * numFrames);
+			return;
+		}
+
+		// Input channels beyond what the file has wrap around its channels, and the file loops.
+		for(i32 i = 0; i < numFrames; ++i)
+		{
+			for(i32 ch = 0; ch < numIn; ++ch)
+			{
+				const i64 srcIdx = fileSample_ * numChannels + (ch % numChannels);
+				in[ch][i] = reinterpret_cast<const f32*>(soundData_.rawData_)[srcIdx];
+			}
+
+			if(++fileSample_ >= numSamples)
+				fileSample_ = 0;
+		}
 	}
 
-	// Perform clipping.
-	for(i32 out = 0; out < outChannels; ++out)
+	AudioHeadlessSettings settings_;
+	Sound::Data soundData_;
+	i64 fileSample_ = 0;
+	f64 phase_ = 0.0;
+	u32 noiseSeed_ = 0x12345678;
+};
+
+static int HeadlessThread(void* userData)
+{
+	AudioBackendImpl* impl_ = (AudioBackendImpl*)userData;
+	const AudioHeadlessSettings& settings = impl_->headlessSettings_;
+	const i32 numIn = impl_->inChannels_;
+	const i32 numOut = impl_->outChannels_;
+	const i32 bufferSize = settings.bufferSize_;
+
+	HeadlessSource source(settings);
+	const i64 totalFrames = source.GetTotalFrames();
+
+	Core::Vector<f32> inData(Core::Max(1, numIn * bufferSize));
+	Core::Vector<f32> outData(Core::Max(1, numOut * bufferSize));
+	Core::Vector<f32*> inPtrs(Core::Max(1, numIn));
+	Core::Vector<f32*> outPtrs(Core::Max(1, numOut));
+	for(i32 ch = 0; ch < numIn; ++ch)
+		inPtrs[ch] = inData.data() + ch * bufferSize;
+	for(i32 ch = 0; ch < numOut; ++ch)
+		outPtrs[ch] = outData.data() + ch * bufferSize;
+
+	// Outputs are streamed interleaved straight into the wav, which is finalized once complete.
+	Core::File outFile;
+	i64 outStreamOffset = 0;
+	Core::Vector<f32> interleaved;
+	if(settings.outputFile_)
 	{
-		ispc::clipping_hard(fout[out], fout[out], frameCount);
+		if(Core::FileExists(settings.outputFile_))
+		{
+			Core::FileRemove(settings.outputFile_);
+		}
+		outFile = Core::File(settings.outputFile_, Core::FileFlags::CREATE | Core::FileFlags::WRITE);
+		if(outFile)
+			outStreamOffset = Sound::BeginSaveStream(outFile, Sound::Format::F32, numOut, settings.sampleRate_);
+		interleaved.resize(numOut * bufferSize);
 	}
 
-	return paContinue;
+	Core::Timer timer;
+	timer.Mark();
+
+	i64 processedFrames = 0;
+	while(impl_->headlessStop_ == 0 && (totalFrames < 0 || processedFrames < totalFrames))
+	{
+		i32 numFrames = bufferSize;
+		if(totalFrames >= 0)
+			numFrames = (i32)Core::Min((i64)bufferSize, totalFrames - processedFrames);
+
+		source.Generate(inPtrs.data(), numIn, numFrames);
+		memset(outData.data(), 0, sizeof(f32) * outData.size());
+
+		ProcessBlock(impl_, inPtrs.data(), outPtrs.data(), numFrames);
+
+		if(outFile)
+		{
+			Sound::Interleave(outPtrs.data(), numOut, numFrames, interleaved.data());
+			outFile.Write(interleaved.data(), sizeof(f32) * numFrames * numOut);
+		}
+
+		processedFrames += numFrames;
+
+		// Wait until a real device would have requested the next block.
+		if(settings.clock_ == AudioHeadlessClock::REALTIME)
+		{
+			const f64 blockDeadline = (f64)processedFrames / (f64)settings.sampleRate_;
+			const f64 remaining = blockDeadline - timer.GetTime();
+			if(remaining > 0.0)
+				Core::Sleep(remaining);
+		}
+	}
+
+	if(outFile)
+	{
+		Sound::EndSaveStream(outFile, outStreamOffset, sizeof(f32) * processedFrames * numOut, processedFrames);
+		outFile = Core::File();
+	}
+
+	Core::AtomicExchg(&impl_->headlessRunning_, 0);
+	return 0;
 }
 
 
@@ -92,6 +1019,7 @@ AudioBackend::AudioBackend()
 
 AudioBackend::~AudioBackend()
 {
+	StopDevice();
 	Pa_Terminate();
 	delete impl_;
 }
@@ -146,12 +1074,7 @@ void AudioBackend::Enumerate()
 
 bool AudioBackend::StartDevice(const AudioDeviceSettings& settings)
 {
-	if(impl_->stream_)
-	{
-		Pa_StopStream(impl_->stream_);
-		Pa_CloseStream(impl_->stream_);
-		impl_->stream_ = nullptr;
-	}
+	StopDevice();
 
 	const auto* inputDevice = GetInputDeviceInfo(settings.inputDevice_);
 	const auto* outputDevice = GetOutputDeviceInfo(settings.outputDevice_);
@@ -161,8 +1084,15 @@ bool AudioBackend::StartDevice(const AudioDeviceSettings& settings)
 	const auto* paDeviceInfoIn = Pa_GetDeviceInfo(inputDevice->deviceIdx_);
 	const auto* paDeviceInfoOut = Pa_GetDeviceInfo(outputDevice->deviceIdx_);
 
-	impl_->inChannels_ = inputDevice->maxIn_;
-	impl_->outChannels_ = outputDevice->maxOut_;
+	// Stream is stopped, so it's safe to update channel counts & recompile routing for the new device.
+	{
+		Core::ScopedMutex lock(impl_->callbackMutex_);
+		impl_->inChannels_ = inputDevice->maxIn_;
+		impl_->outChannels_ = outputDevice->maxOut_;
+		impl_->sampleRate_ = settings.sampleRate_;
+		impl_->PublishCallbacks();
+		impl_->ReclaimRetiredLists(false);
+	}
 
 	PaStreamParameters inParams;
 	inParams.device = inputDevice->deviceIdx_;
@@ -178,22 +1108,137 @@ bool AudioBackend::StartDevice(const AudioDeviceSettings& settings)
 	outParams.suggestedLatency = paDeviceInfoOut->defaultLowOutputLatency;
 	outParams.hostApiSpecificStreamInfo = nullptr;
 
-	impl_->inStreams_.resize(impl_->inChannels_);
-	impl_->outStreams_.resize(impl_->outChannels_);
+	// Let the host pick its preferred block size if requested. Callbacks still see a fixed quantum if set.
+	const u32 framesPerBuffer = settings.hostBufferUnspecified_ ? paFramesPerBufferUnspecified : settings.bufferSize_;
+	const i32 hostFrames = settings.hostBufferUnspecified_ ? 0 : settings.bufferSize_;
+
+	impl_->StartWorkers(settings.numWorkers_);
+	impl_->PrepareOutputStage(settings, Core::Max(settings.bufferSize_, 256));
 
 	PaError err;
-	err = Pa_OpenStream(&impl_->stream_, &inParams, &outParams, settings.sampleRate_, settings.bufferSize_, paClipOff | paDitherOff, StaticStreamCallback, impl_);
+	if(settings.separateStreams_)
+	{
+		// Input & output run from independent clocks, joined by a bridge which compensates for drift.
+		// Bridge hands out blocks of a fixed size, so align quanta to it.
+		const i32 maxFrames = Core::Max(settings.bufferSize_, 256);
+		impl_->PrepareQuantum(settings.quantum_, (settings.quantum_ > 0 && (maxFrames % settings.quantum_) == 0) ? hostFrames : 0);
+		impl_->bridge_ = new AudioStreamBridge(impl_->inChannels_, maxFrames, settings.bufferSize_ * 2);
+		impl_->bridgeData_.resize(impl_->inChannels_ * maxFrames);
+		impl_->bridgeIn_.resize(impl_->inChannels_);
+		impl_->bridgeOut_.resize(impl_->outChannels_);
+		for(i32 in = 0; in < impl_->inChannels_; ++in)
+			impl_->bridgeIn_[in] = impl_->bridgeData_.data() + in * maxFrames;
+
+		err = Pa_OpenStream(&impl_->inStream_, &inParams, nullptr, settings.sampleRate_, framesPerBuffer, paClipOff | paDitherOff, StaticInputStreamCallback, impl_);
+		if(!err)
+			err = Pa_OpenStream(&impl_->stream_, nullptr, &outParams, settings.sampleRate_, framesPerBuffer, paClipOff | paDitherOff, StaticOutputStreamCallback, impl_);
+		if(!err)
+			err = Pa_StartStream(impl_->inStream_);
+	}
+	else
+	{
+		impl_->PrepareQuantum(settings.quantum_, hostFrames);
+		err = Pa_OpenStream(&impl_->stream_, &inParams, &outParams, settings.sampleRate_, framesPerBuffer, paClipOff | paDitherOff, StaticStreamCallback, impl_);
+	}
+
+	if(!err)
+		err = Pa_StartStream(impl_->stream_);
 	if(err)
+	{
+		StopDevice();
 		return false;
-	err = Pa_StartStream(impl_->stream_);
-	if(err)
+	}
+
+	if(const auto* streamInfo = Pa_GetStreamInfo(impl_->inStream_ ? impl_->inStream_ : impl_->stream_))
+		impl_->reportedInputLatency_ = streamInfo->inputLatency;
+	if(const auto* streamInfo = Pa_GetStreamInfo(impl_->stream_))
+		impl_->reportedOutputLatency_ = streamInfo->outputLatency;
+
+	return true;
+}
+
+bool AudioBackend::StartHeadless(const AudioHeadlessSettings& settings)
+{
+	StopDevice();
+
+	if(settings.bufferSize_ <= 0 || settings.sampleRate_ <= 0)
+		return false;
+
+	impl_->headlessSettings_ = settings;
+	impl_->headlessSettings_.inputFile_ = nullptr;
+	impl_->headlessSettings_.outputFile_ = nullptr;
+	if(settings.inputFile_)
+	{
+		strcpy_s(impl_->headlessInputFile_.data(), impl_->headlessInputFile_.size(), settings.inputFile_);
+		impl_->headlessSettings_.inputFile_ = impl_->headlessInputFile_.data();
+	}
+	if(settings.outputFile_)
+	{
+		strcpy_s(impl_->headlessOutputFile_.data(), impl_->headlessOutputFile_.size(), settings.outputFile_);
+		impl_->headlessSettings_.outputFile_ = impl_->headlessOutputFile_.data();
+	}
+
+	{
+		Core::ScopedMutex lock(impl_->callbackMutex_);
+		impl_->inChannels_ = settings.numIn_;
+		impl_->outChannels_ = settings.numOut_;
+		impl_->sampleRate_ = settings.sampleRate_;
+		impl_->PublishCallbacks();
+		impl_->ReclaimRetiredLists(false);
+	}
+
+	AudioDeviceSettings outputSettings;
+	outputSettings.outputStage_ = settings.outputStage_;
+	impl_->StartWorkers(settings.numWorkers_);
+	impl_->PrepareOutputStage(outputSettings, settings.bufferSize_);
+	impl_->PrepareQuantum(settings.quantum_, settings.bufferSize_);
+
+	impl_->headlessStop_ = 0;
+	impl_->headlessRunning_ = 1;
+	impl_->headlessThread_ = Core::Thread(HeadlessThread, impl_, Core::Thread::DEFAULT_STACK_SIZE, "Headless Audio");
+	return true;
+}
+
+void AudioBackend::StopDevice()
+{
+	if(impl_->stream_)
 	{
+		Pa_StopStream(impl_->stream_);
 		Pa_CloseStream(impl_->stream_);
 		impl_->stream_ = nullptr;
-		return false;
 	}
 
-	return true;
+	if(impl_->inStream_)
+	{
+		Pa_StopStream(impl_->inStream_);
+		Pa_CloseStream(impl_->inStream_);
+		impl_->inStream_ = nullptr;
+	}
+
+	delete impl_->bridge_;
+	impl_->bridge_ = nullptr;
+	impl_->reportedInputLatency_ = 0.0;
+	impl_->reportedOutputLatency_ = 0.0;
+
+	if(impl_->headlessThread_)
+	{
+		Core::AtomicExchg(&impl_->headlessStop_, 1);
+		impl_->headlessThread_.Join();
+		impl_->headlessThread_ = Core::Thread();
+	}
+}
+
+void AudioBackend::GetReportedLatency(f64& outInputLatency, f64& outOutputLatency) const
+{
+	outInputLatency = impl_->reportedInputLatency_;
+	outOutputLatency = impl_->reportedOutputLatency_;
+}
+
+bool AudioBackend::IsRunning() const
+{
+	if(impl_->stream_)
+		return Pa_IsStreamActive(impl_->stream_) == 1;
+	return impl_->headlessRunning_ != 0;
 }
 
 i32 AudioBackend::GetNumInputDevices() const
@@ -241,17 +1286,51 @@ const AudioDeviceInfo* AudioBackend::GetOutputDeviceInfo(const Core::UUID& uuid)
 }
 
 
-bool AudioBackend::RegisterCallback(IAudioCallback* callback, u32 inMask, u32 outMask)
+bool AudioBackend::RegisterCallback(IAudioCallback* callback, u32 inMask, u32 outMask, IAudioCallback* const* dependencies, i32 numDependencies)
 {
-	UnregisterCallback(callback);
-
 	AudioBackendImpl::Callback callbackObj;
 	callbackObj.callback_ = callback;
 	callbackObj.inMask_ = inMask;
 	callbackObj.outMask_ = outMask;
+	callbackObj.dependencies_.insert(callbackObj.dependencies_.end(), dependencies, dependencies + numDependencies);
 
 	Core::ScopedMutex lock(impl_->callbackMutex_);
-	impl_->callbacks_.push_back(callbackObj);
+	auto it = std::find_if(impl_->callbacks_.begin(), impl_->callbacks_.end(),
+		[callback](const AudioBackendImpl::Callback& callbackObj)
+		{
+			return callbackObj.callback_ == callback;
+		});
+	AudioBackendImpl::Callback prevCallbackObj;
+	const bool isExisting = it != impl_->callbacks_.end();
+	if(isExisting)
+	{
+		prevCallbackObj = *it;
+		callbackObj.stats_ = prevCallbackObj.stats_;
+		*it = callbackObj;
+	}
+	else
+	{
+		callbackObj.stats_ = new AudioCallbackStats();
+		callbackObj.stats_->name_ = callback->GetName();
+		callbackObj.stats_->callback_ = callback;
+		impl_->callbacks_.push_back(callbackObj);
+	}
+
+	// Reject registrations which would introduce a dependency cycle.
+	if(!impl_->PublishCallbacks())
+	{
+		if(isExisting)
+		{
+			*it = prevCallbackObj;
+		}
+		else
+		{
+			delete callbackObj.stats_;
+			impl_->callbacks_.pop_back();
+		}
+		return false;
+	}
+	impl_->ReclaimRetiredLists(false);
 
 	return true;
 }
@@ -266,8 +1345,79 @@ void AudioBackend::UnregisterCallback(IAudioCallback* callback)
 		});
 	if(it != impl_->callbacks_.end())
 	{
+		auto* stats = it->stats_;
 		impl_->callbacks_.erase(it);
+		impl_->PublishCallbacks();
+
+		// Caller is free to destroy the callback once we return, so wait for the audio thread to let go of it.
+		impl_->ReclaimRetiredLists(true);
+		delete stats;
 	}
 }
 
+void AudioBackend::GetStats(AudioStats& outStats) const
+{
+	outStats = impl_->stats_;
+	outStats.cpuLoad_ = impl_->stream_ ? Pa_GetStreamCpuLoad(impl_->stream_) : 0.0;
+	if(impl_->bridge_)
+	{
+		outStats.bridgeRatio_ = impl_->bridge_->GetRatio();
+		outStats.bridgeLatency_ = impl_->bridge_->GetQueuedFrames();
+		outStats.bridgeUnderruns_ = impl_->bridge_->GetUnderruns();
+		outStats.bridgeOverruns_ = impl_->bridge_->GetOverruns();
+	}
+}
+
+void AudioBackend::GetCallbackStats(Core::Vector<AudioCallbackStats>& outStats) const
+{
+	Core::ScopedMutex lock(impl_->callbackMutex_);
+	outStats.clear();
+
+	// Report in processing order.
+	const auto* list = impl_->publishedList_;
+	if(list)
+	{
+		for(const auto& route : list->routes_)
+			outStats.push_back(*route.stats_);
+	}
+}
+
+void AudioBackend::ResetStats()
+{
+	Core::ScopedMutex lock(impl_->callbackMutex_);
+	impl_->stats_ = AudioStats();
+	for(auto& callback : impl_->callbacks_)
+		callback.stats_->utilisation_ = AudioHistogram();
+}
+
+void AudioBackend::LogStats() const
+{
+	AudioStats stats;
+	GetStats(stats);
+	Core::Log("Audio: %d blocks (%d-%d frames), cpu load %.1f%%, output latency %.2fms\n",
+		stats.numBlocks_, stats.minFrames_, stats.maxFrames_, stats.cpuLoad_ * 100.0, stats.outputLatency_ * 1000.0);
+	Core::Log("Audio: input underflows %d, input overflows %d, output underflows %d, output overflows %d\n",
+		stats.inputUnderflows_, stats.inputOverflows_, stats.outputUnderflows_, stats.outputOverflows_);
+	if(impl_->bridge_)
+		Core::Log("Audio: bridge ratio %.6f, latency %d frames, underruns %d, overruns %d\n",
+			stats.bridgeRatio_, stats.bridgeLatency_, stats.bridgeUnderruns_, stats.bridgeOverruns_);
+
+	auto logHistogram = [](const char* name, const AudioHistogram& histogram)
+	{
+		Core::Log("Audio: %-24s mean %6.2f%%, max %6.2f%% of deadline\n", name, histogram.GetMean() * 100.0f, histogram.max_ * 100.0f);
+		for(i32 bucket = 0; bucket < AudioHistogram::NUM_BUCKETS; ++bucket)
+		{
+			if(histogram.buckets_[bucket] > 0)
+				Core::Log("Audio:     <= %6.2f%%: %d\n", AudioHistogram::GetBucketLimit(bucket) * 100.0f, histogram.buckets_[bucket]);
+		}
+	};
+
+	logHistogram("Total", stats.utilisation_);
+
+	Core::Vector<AudioCallbackStats> callbackStats;
+	GetCallbackStats(callbackStats);
+	for(const auto& callback : callbackStats)
+		logHistogram(callback.name_, callback.utilisation_);
+}
+
 
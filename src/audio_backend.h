@@ -2,6 +2,7 @@
 
 #include "core/types.h"
 #include "core/uuid.h"
+#include "core/vector.h"
 #include "serialization/serializer.h"
 
 struct AudioDeviceInfo
@@ -16,12 +17,35 @@ struct AudioDeviceInfo
 	i32 deviceIdx_ = 0;
 };
 
+/// Final stage applied to outputs to keep them within [-1, 1].
+enum class AudioOutputStage
+{
+	HARD_CLIP = 0,
+	SOFT_CLIP,
+	LIMITER,
+};
+
 struct AudioDeviceSettings
 {
 	Core::UUID inputDevice_;
 	Core::UUID outputDevice_;
 	i32 bufferSize_ = 1024;
 	i32 sampleRate_ = 48000;
+	/// Worker threads used alongside the audio thread to run independent callbacks in parallel.
+	i32 numWorkers_ = 0;
+	/// Run input & output as separate streams, compensating for drift between their clocks.
+	bool separateStreams_ = false;
+	/// Fixed number of frames callbacks are run with, 0 to use whatever the device provides.
+	i32 quantum_ = 0;
+	/// Let the device pick its own buffer size. @a bufferSize_ is then only a hint for latency.
+	bool hostBufferUnspecified_ = false;
+	/// Output stage & limiter parameters.
+	AudioOutputStage outputStage_ = AudioOutputStage::LIMITER;
+	f32 limiterCeiling_ = 0.98f;
+	f32 limiterLookaheadMs_ = 1.5f;
+	f32 limiterReleaseMs_ = 50.0f;
+	/// Measured round trip latency from output to input in frames at @a sampleRate_, 0 if not measured.
+	i32 roundTripLatency_ = 0;
 
 	bool Serialize(Serialization::Serializer& ser)
 	{
@@ -29,16 +53,75 @@ struct AudioDeviceSettings
 		ser.Serialize("outputDevice", outputDevice_);
 		ser.Serialize("bufferSize", bufferSize_);
 		ser.Serialize("sampleRate", sampleRate_);
+		ser.Serialize("numWorkers", numWorkers_);
+		ser.Serialize("separateStreams", separateStreams_);
+		ser.Serialize("quantum", quantum_);
+		ser.Serialize("hostBufferUnspecified", hostBufferUnspecified_);
+		i32 outputStage = (i32)outputStage_;
+		ser.Serialize("outputStage", outputStage);
+		outputStage_ = (AudioOutputStage)outputStage;
+		ser.Serialize("limiterCeiling", limiterCeiling_);
+		ser.Serialize("limiterLookaheadMs", limiterLookaheadMs_);
+		ser.Serialize("limiterReleaseMs", limiterReleaseMs_);
+		ser.Serialize("roundTripLatency", roundTripLatency_);
 		return true;
 	}
 };
 
+/// Signal used to drive inputs of a headless device.
+enum class AudioHeadlessSource
+{
+	SILENCE = 0,
+	SINE,
+	NOISE,
+	FILE,
+};
+
+/// How a headless device is clocked.
+enum class AudioHeadlessClock
+{
+	/// Process blocks at the rate a real device would request them.
+	REALTIME = 0,
+	/// Process blocks as fast as possible.
+	FAST,
+};
+
+struct AudioHeadlessSettings
+{
+	AudioHeadlessSource source_ = AudioHeadlessSource::SINE;
+	AudioHeadlessClock clock_ = AudioHeadlessClock::FAST;
+	/// Sound file to read inputs from when using AudioHeadlessSource::FILE.
+	const char* inputFile_ = nullptr;
+	/// Wav file to write outputs to. Optional.
+	const char* outputFile_ = nullptr;
+	i32 numIn_ = 2;
+	i32 numOut_ = 2;
+	i32 bufferSize_ = 1024;
+	i32 sampleRate_ = 48000;
+	/// Worker threads used alongside the audio thread to run independent callbacks in parallel.
+	i32 numWorkers_ = 0;
+	/// Fixed number of frames callbacks are run with, 0 to use @a bufferSize_.
+	i32 quantum_ = 0;
+	/// Output stage, using default limiter parameters from AudioDeviceSettings.
+	AudioOutputStage outputStage_ = AudioOutputStage::LIMITER;
+	/// Frequency of sine source.
+	f32 frequency_ = 440.0f;
+	/// Amplitude of sine & noise sources.
+	f32 amplitude_ = 0.5f;
+	/// Seconds of audio to process. If <= 0, file sources stop at end of file, others run until stopped.
+	f64 duration_ = 0.0;
+};
 
 class IAudioCallback
 {
 public:
 	virtual ~IAudioCallback() {}
 
+	/**
+	 * Name used to identify callback in stats & diagnostics.
+	 */
+	virtual const char* GetName() const { return "Unnamed"; }
+
 	/**
 	 * Called when there is audio data to process.
 	 * @param numIn Number of input channels.
@@ -50,6 +133,79 @@ public:
 	virtual void OnAudioCallback(i32 numIn, i32 numOut, const f32** in, f32** out, i32 numFrames) = 0;
 };
 
+/**
+ * Histogram of block timings, as a fraction of the block deadline.
+ * Written by a single thread at a time, safe to read from any thread.
+ */
+struct AudioHistogram
+{
+	static const i32 NUM_BUCKETS = 32;
+	/// Deadline fraction covered by the last bucket. Anything above is clamped into it.
+	static const i32 MAX_DEADLINES = 2;
+
+	volatile i32 buckets_[NUM_BUCKETS] = {};
+	volatile i32 count_ = 0;
+	volatile f32 last_ = 0.0f;
+	volatile f32 max_ = 0.0f;
+	volatile f32 total_ = 0.0f;
+
+	void Add(f32 value)
+	{
+		i32 bucket = (i32)((value / (f32)MAX_DEADLINES) * (f32)NUM_BUCKETS);
+		bucket = bucket < 0 ? 0 : (bucket >= NUM_BUCKETS ? NUM_BUCKETS - 1 : bucket);
+		buckets_[bucket] = buckets_[bucket] + 1;
+		count_ = count_ + 1;
+		last_ = value;
+		total_ = total_ + value;
+		if(value > max_)
+			max_ = value;
+	}
+
+	f32 GetMean() const { return count_ > 0 ? total_ / (f32)count_ : 0.0f; }
+
+	/// @return Upper bound of @a bucket, as a fraction of the block deadline.
+	static f32 GetBucketLimit(i32 bucket) { return ((f32)(bucket + 1) / (f32)NUM_BUCKETS) * (f32)MAX_DEADLINES; }
+};
+
+/**
+ * Timings for a single callback.
+ */
+struct AudioCallbackStats
+{
+	const char* name_ = nullptr;
+	IAudioCallback* callback_ = nullptr;
+	/// Time spent in callback, as a fraction of the block deadline.
+	AudioHistogram utilisation_;
+};
+
+/**
+ * Device level stats.
+ */
+struct AudioStats
+{
+	volatile i32 numBlocks_ = 0;
+	volatile i32 inputUnderflows_ = 0;
+	volatile i32 inputOverflows_ = 0;
+	volatile i32 outputUnderflows_ = 0;
+	volatile i32 outputOverflows_ = 0;
+	volatile i32 outputPriming_ = 0;
+	/// Smallest & largest frame counts requested by the device.
+	volatile i32 minFrames_ = 0;
+	volatile i32 maxFrames_ = 0;
+	/// Time between the callback being invoked and the output reaching the DAC, in seconds.
+	volatile f64 outputLatency_ = 0.0;
+	/// Time spent in all callbacks, as a fraction of the block deadline.
+	AudioHistogram utilisation_;
+	/// CPU load reported by the device, 0 for headless devices.
+	f64 cpuLoad_ = 0.0;
+
+	/// Separate stream bridge. Resampling ratio applied to input, and frames queued.
+	f32 bridgeRatio_ = 1.0f;
+	i32 bridgeLatency_ = 0;
+	i32 bridgeUnderruns_ = 0;
+	i32 bridgeOverruns_ = 0;
+};
+
 class AudioBackend
 {
 public:
@@ -58,6 +214,23 @@ public:
 	void Enumerate();
 	bool StartDevice(const AudioDeviceSettings& settings);
 
+	/**
+	 * Start a device with no audio hardware behind it.
+	 * Callbacks are driven from a background thread using the same dispatch as a real device.
+	 */
+	bool StartHeadless(const AudioHeadlessSettings& settings);
+
+	/**
+	 * Stop the current device, if any.
+	 */
+	void StopDevice();
+
+	/**
+	 * Is a device currently running?
+	 * Headless devices with a duration will stop themselves once complete.
+	 */
+	bool IsRunning() const;
+
 	i32 GetNumInputDevices() const;
 	i32 GetNumOutputDevices() const;
 	const AudioDeviceInfo& GetInputDeviceInfo(i32 idx);
@@ -66,9 +239,45 @@ public:
 	const AudioDeviceInfo* GetOutputDeviceInfo(const Core::UUID& uuid);
 	
 
-	bool RegisterCallback(IAudioCallback* callback, u32 inMask, u32 outMask);
+	/**
+	 * Register a callback to be run each block.
+	 * Callbacks without a dependency between them may run concurrently on worker threads.
+	 * Callbacks writing to the same output channel always run in registration order.
+	 * @param inMask Mask of input channels to receive.
+	 * @param outMask Mask of output channels to write.
+	 * @param dependencies Callbacks which must complete before @a callback runs each block.
+	 * @param numDependencies Number of @a dependencies.
+	 * @return false if dependencies would form a cycle.
+	 */
+	bool RegisterCallback(IAudioCallback* callback, u32 inMask, u32 outMask, IAudioCallback* const* dependencies = nullptr, i32 numDependencies = 0);
 	void UnregisterCallback(IAudioCallback* callback);
 
+	/**
+	 * Get input & output latency reported by the device for the current stream, in seconds.
+	 * Both are 0 for headless devices.
+	 */
+	void GetReportedLatency(f64& outInputLatency, f64& outOutputLatency) const;
+
+	/**
+	 * Get device level stats.
+	 */
+	void GetStats(AudioStats& outStats) const;
+
+	/**
+	 * Get timings for all registered callbacks, in processing order.
+	 */
+	void GetCallbackStats(Core::Vector<AudioCallbackStats>& outStats) const;
+
+	/**
+	 * Reset device & callback stats.
+	 */
+	void ResetStats();
+
+	/**
+	 * Write device & callback stats to the log.
+	 */
+	void LogStats() const;
+
 
 private:
 	struct AudioBackendImpl* impl_ = nullptr;
@@ -13,6 +13,7 @@ namespace Callbacks
 		AudioBufferCallback();
 		virtual ~AudioBufferCallback();
 		void OnAudioCallback(i32 numIn, i32 numOut, const f32** in, f32** out, i32 numFrames) override;
+		const char* GetName() const override { return "Buffer"; }
 
 		// NOTE: These should technically be synchronised, however this is mostly for just visualising.
 		// Will create a synchronised interface if extending it further.
@@ -0,0 +1,143 @@
+#include "audio_latency_callback.h"
+#include "ispc/fft_ispc.h"
+
+#include "core/concurrency.h"
+#include "core/misc.h"
+
+#include <cmath>
+#include <cstring>
+
+namespace Callbacks
+{
+	namespace
+	{
+		/// Chirp length, sweep range & level.
+		const f64 CHIRP_DURATION = 0.25;
+		const f64 CHIRP_FADE = 0.005;
+		const f64 CHIRP_START_HZ = 200.0;
+		const f64 CHIRP_END_HZ = 16000.0;
+		const f32 CHIRP_AMPLITUDE = 0.5f;
+
+		/// Longest round trip we can measure.
+		const f64 MAX_LATENCY = 1.0;
+
+		/// Minimum peak to mean ratio for a measurement to be trusted.
+		const f32 MIN_CONFIDENCE = 10.0f;
+	}
+
+	AudioLatencyCallback::AudioLatencyCallback()
+	{
+	}
+
+	AudioLatencyCallback::~AudioLatencyCallback()
+	{
+	}
+
+	void AudioLatencyCallback::OnAudioCallback(i32 numIn, i32 numOut, const f32** in, f32** out, i32 numFrames)
+	{
+		if(state_ != (i32)State::RUNNING)
+			return;
+
+		const i32 numChirp = chirp_.size();
+		const i32 numCapture = capture_.size();
+		const i32 numToCapture = Core::Min(numFrames, numCapture - position_);
+		for(i32 i = 0; i < numToCapture; ++i)
+		{
+			const i32 position = position_ + i;
+			const f32 sample = position < numChirp ? chirp_[position] : 0.0f;
+			for(i32 j = 0; j < numOut; ++j)
+				out[j][i] += sample;
+			capture_[position] = numIn > 0 ? in[0][i] : 0.0f;
+		}
+
+		position_ += numToCapture;
+		if(position_ == numCapture)
+			Core::AtomicExchg(&state_, (i32)State::CAPTURED);
+	}
+
+	bool AudioLatencyCallback::Start(i32 sampleRate)
+	{
+		if(state_ == (i32)State::RUNNING || state_ == (i32)State::CAPTURED || sampleRate <= 0)
+			return false;
+
+		// Linear sweep with short fades to avoid clicks.
+		const i32 numChirp = (i32)(CHIRP_DURATION * sampleRate);
+		const i32 numFade = (i32)(CHIRP_FADE * sampleRate);
+		const f64 startHz = CHIRP_START_HZ;
+		const f64 endHz = Core::Min(CHIRP_END_HZ, sampleRate * 0.4);
+		const f64 pi = 3.14159265358979323846;
+		chirp_.resize(numChirp);
+		for(i32 i = 0; i < numChirp; ++i)
+		{
+			const f64 t = (f64)i / (f64)sampleRate;
+			const f64 phase = 2.0 * pi * (startHz * t + 0.5 * (endHz - startHz) * t * t / CHIRP_DURATION);
+			f64 gain = CHIRP_AMPLITUDE;
+			if(i < numFade)
+				gain *= (f64)i / (f64)numFade;
+			else if(i >= numChirp - numFade)
+				gain *= (f64)(numChirp - i) / (f64)numFade;
+			chirp_[i] = (f32)(std::sin(phase) * gain);
+		}
+
+		capture_.resize(numChirp + (i32)(MAX_LATENCY * sampleRate));
+		sampleRate_ = sampleRate;
+		position_ = 0;
+		latency_ = 0;
+		confidence_ = 0.0f;
+		Core::AtomicExchg(&state_, (i32)State::RUNNING);
+		return true;
+	}
+
+	bool AudioLatencyCallback::Update()
+	{
+		if(state_ != (i32)State::CAPTURED)
+			return false;
+
+		// Cross correlate capture with chirp via FFT, padded so the correlation doesn't wrap.
+		const i32 numChirp = chirp_.size();
+		const i32 numCapture = capture_.size();
+		i32 numValues = 1;
+		while(numValues < numCapture + numChirp)
+			numValues <<= 1;
+
+		Core::Vector<f32> captureRe;
+		Core::Vector<f32> captureIm;
+		Core::Vector<f32> chirpRe;
+		Core::Vector<f32> chirpIm;
+		for(auto* values : { &captureRe, &captureIm, &chirpRe, &chirpIm })
+		{
+			values->resize(numValues);
+			memset(values->data(), 0, sizeof(f32) * numValues);
+		}
+		memcpy(captureRe.data(), capture_.data(), sizeof(f32) * numCapture);
+		memcpy(chirpRe.data(), chirp_.data(), sizeof(f32) * numChirp);
+
+		ispc::fft_process(captureRe.data(), captureIm.data(), numValues, false);
+		ispc::fft_process(chirpRe.data(), chirpIm.data(), numValues, false);
+		ispc::fft_multiply_conjugate(captureRe.data(), captureIm.data(), chirpRe.data(), chirpIm.data(), numValues);
+		ispc::fft_process(captureRe.data(), captureIm.data(), numValues, true);
+
+		// Polarity may be inverted somewhere in the chain, so look for the largest magnitude.
+		const i32 numLags = numCapture - numChirp + 1;
+		i32 peakLag = 0;
+		f32 peak = 0.0f;
+		f64 total = 0.0;
+		for(i32 lag = 0; lag < numLags; ++lag)
+		{
+			const f32 value = std::abs(captureRe[lag]);
+			total += value;
+			if(value > peak)
+			{
+				peak = value;
+				peakLag = lag;
+			}
+		}
+
+		const f32 mean = (f32)(total / numLags);
+		confidence_ = mean > 0.0f ? peak / mean : 0.0f;
+		latency_ = peakLag;
+		Core::AtomicExchg(&state_, (i32)(confidence_ >= MIN_CONFIDENCE ? State::DONE : State::FAILED));
+		return true;
+	}
+
+} // namespace Callbacks
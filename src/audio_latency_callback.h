@@ -0,0 +1,62 @@
+#pragma once
+
+#include "audio_backend.h"
+#include "core/vector.h"
+
+namespace Callbacks
+{
+	/// Measures round trip latency by playing a chirp on the outputs and finding it in the input.
+	class AudioLatencyCallback : public IAudioCallback
+	{
+	public:
+		enum class State : i32
+		{
+			IDLE = 0,
+			/// Playing chirp & capturing input.
+			RUNNING,
+			/// Capture complete, waiting for Update to analyse it.
+			CAPTURED,
+			DONE,
+			/// Chirp couldn't be found in the input, check routing & levels.
+			FAILED,
+		};
+
+		AudioLatencyCallback();
+		virtual ~AudioLatencyCallback();
+		void OnAudioCallback(i32 numIn, i32 numOut, const f32** in, f32** out, i32 numFrames) override;
+		const char* GetName() const override { return "Latency"; }
+
+		/**
+		 * Start a measurement. Allocates buffers, so call from the main thread.
+		 * @return false if a measurement is already in progress.
+		 */
+		bool Start(i32 sampleRate);
+
+		/**
+		 * Analyse a completed capture. Call from the main thread.
+		 * @return true if a measurement finished during this call.
+		 */
+		bool Update();
+
+		State GetState() const { return (State)state_; }
+
+		/// Round trip latency in frames, valid when DONE.
+		i32 GetLatency() const { return latency_; }
+		/// Round trip latency in seconds, valid when DONE.
+		f64 GetLatencySeconds() const { return sampleRate_ > 0 ? (f64)latency_ / (f64)sampleRate_ : 0.0; }
+		/// Ratio of the correlation peak to its mean magnitude.
+		f32 GetConfidence() const { return confidence_; }
+
+	private:
+		volatile i32 state_ = (i32)State::IDLE;
+		i32 sampleRate_ = 0;
+
+		/// Chirp to play, and input captured while playing it. Owned by the audio thread while RUNNING.
+		Core::Vector<f32> chirp_;
+		Core::Vector<f32> capture_;
+		i32 position_ = 0;
+
+		i32 latency_ = 0;
+		f32 confidence_ = 0.0f;
+	};
+} // namespace Callbacks
@@ -1,67 +1,411 @@
 #include "audio_playback_callback.h"
 #include "app.h"
+#include "resampler.h"
+#include "ring_buffer.h"
+#include "sound.h"
 
-#include "core/file.h"
+#include "core/misc.h"
+#include "core/vector.h"
 #include "job/manager.h"
 
+#include <cstring>
 #include <utility>
 
 namespace Callbacks
 {
-	AudioPlaybackCallback::AudioPlaybackCallback()
+	namespace
+	{
+		/// Frames the audio thread reads from the ring buffer at a time.
+		const i32 READ_BLOCK_FRAMES = 256;
+		/// How often the streamer checks for space.
+		const f64 STREAMER_SLEEP = 0.005;
+	}
+
+	/**
+	 * Everything needed to play a single sound. Opened on the loader job, then only touched by
+	 * the audio thread & streamer thread until retired.
+	 * Sources without a file name, or that failed to open, stop playback.
+	 */
+	struct PlaybackSource
+	{
+		PlaybackSource(const char* fileName)
+		{
+			strcpy_s(fileName_.data(), fileName_.size(), fileName ? fileName : "");
+		}
+
+		~PlaybackSource()
+		{
+			delete inputStream_;
+			delete resampler_;
+		}
+
+		bool Open(Sound::SampleCache* sampleCache, i32 deviceSampleRate);
+
+		/// Read a block from the sound into the ring buffer, if there is space.
+		bool Fill();
+
+		/// Read, seek & tell on either the cached sound or the input stream.
+		i32 Read(f32* data, i32 numFrames);
+		void Seek(i64 frame);
+		i64 Tell() const;
+
+		Core::Array<char, Core::MAX_PATH_LENGTH> fileName_;
+
+		/// Stream being read from.
+		Sound::InputStream* inputStream_ = nullptr;
+		/// Sound being played from memory instead of a stream.
+		Sound::CachedData cachedData_;
+		i64 cachedPosition_ = 0;
+		Core::Vector<f32> streamBlock_;
+		/// Converts from the file's sample rate to the device's, if they differ.
+		Resampler* resampler_ = nullptr;
+		Core::Vector<f32> resampleBlock_;
+		/// Interleaved frames read ahead of the audio thread, at the device's sample rate.
+		RingBuffer<f32> ring_;
+		/// Scratch used by the audio thread to read from the ring buffer.
+		Core::Vector<f32> readBuffer_;
+		i32 numChannels_ = 0;
+		i64 numFrames_ = 0;
+		i32 sampleRate_ = 0;
+		/// Frame in the file at the write end of the ring buffer.
+		volatile i64 streamPosition_ = 0;
+		/// Flush handshake for seeking: 1 when requested by streamer, 2 when acknowledged by the audio thread.
+		volatile i32 flush_ = 0;
+	};
+
+	bool PlaybackSource::Open(Sound::SampleCache* sampleCache, i32 deviceSampleRate)
+	{
+		if(fileName_[0] == '\0')
+			return false;
+
+		// Play from memory if already decoded, otherwise stream.
+		Sound::CachedData cachedData = sampleCache ? sampleCache->Find(fileName_.data()) : Sound::CachedData();
+		if(cachedData && cachedData.GetData().numSamples_ > 0)
+		{
+			const Sound::Data& data = cachedData.GetData();
+			numChannels_ = data.numChannels_;
+			numFrames_ = data.numSamples_;
+			sampleRate_ = data.sampleRate_;
+			cachedData_ = std::move(cachedData);
+		}
+		else
+		{
+			auto* inputStream = new Sound::InputStream(fileName_.data());
+			if(!*inputStream || inputStream->GetNumFrames() == 0)
+			{
+				delete inputStream;
+				return false;
+			}
+
+			inputStream_ = inputStream;
+			numChannels_ = inputStream->GetNumChannels();
+			numFrames_ = inputStream->GetNumFrames();
+			sampleRate_ = inputStream->GetSampleRate();
+		}
+
+		streamBlock_.resize(AudioPlaybackCallback::STREAM_BLOCK_FRAMES * numChannels_);
+
+		// Resample on the streamer thread, so the audio thread only ever copies.
+		if(sampleRate_ != deviceSampleRate && sampleRate_ > 0 && deviceSampleRate > 0)
+		{
+			resampler_ = new Resampler(numChannels_, sampleRate_, deviceSampleRate, ResamplerQuality::HIGH);
+			resampleBlock_.resize(((i32)resampler_->GetNumOutputFrames(AudioPlaybackCallback::STREAM_BLOCK_FRAMES) + 1) * numChannels_);
+		}
+
+		readBuffer_.resize(READ_BLOCK_FRAMES * numChannels_);
+		ring_.Resize(AudioPlaybackCallback::STREAM_BLOCK_FRAMES * AudioPlaybackCallback::STREAM_NUM_BLOCKS * numChannels_);
+
+		// Prime before handing over, so playback starts with a full buffer.
+		while(Fill())
+		{
+		}
+		return true;
+	}
+
+	bool PlaybackSource::Fill()
+	{
+		const i32 blockSize = resampler_ ? resampleBlock_.size() : streamBlock_.size();
+		if(ring_.GetNumWritable() < blockSize)
+			return false;
+
+		i32 numRead = Read(streamBlock_.data(), AudioPlaybackCallback::STREAM_BLOCK_FRAMES);
+		if(numRead < AudioPlaybackCallback::STREAM_BLOCK_FRAMES)
+		{
+			// Loop back to the start.
+			Seek(0);
+			numRead += Read(streamBlock_.data() + numRead * numChannels_, AudioPlaybackCallback::STREAM_BLOCK_FRAMES - numRead);
+		}
+
+		if(resampler_)
+		{
+			// Output may be capped before all input is consumed, so carry on until it has been.
+			for(i32 offset = 0; offset < numRead; )
+			{
+				i32 numConsumed = 0;
+				const i32 numResampled = resampler_->Process(streamBlock_.data() + offset * numChannels_, numRead - offset, numConsumed,
+					resampleBlock_.data(), resampleBlock_.size() / numChannels_);
+				ring_.Write(resampleBlock_.data(), numResampled * numChannels_);
+				offset += numConsumed;
+				if(numConsumed == 0 && numResampled == 0)
+					break;
+			}
+		}
+		else
+		{
+			ring_.Write(streamBlock_.data(), numRead * numChannels_);
+		}
+		Core::AtomicExchg(&streamPosition_, Tell());
+		return numRead > 0;
+	}
+
+	i32 PlaybackSource::Read(f32* data, i32 numFrames)
+	{
+		if(inputStream_)
+			return inputStream_->Read(data, numFrames);
+
+		const i32 numRead = (i32)Core::Min((i64)numFrames, numFrames_ - cachedPosition_);
+		memcpy(data, cachedData_.GetSamples() + cachedPosition_ * numChannels_, sizeof(f32) * numRead * numChannels_);
+		cachedPosition_ += numRead;
+		return numRead;
+	}
+
+	void PlaybackSource::Seek(i64 frame)
+	{
+		if(inputStream_)
+			inputStream_->Seek(frame);
+		else
+			cachedPosition_ = Core::Clamp(frame, (i64)0, numFrames_);
+	}
+
+	i64 PlaybackSource::Tell() const
+	{
+		return inputStream_ ? inputStream_->Tell() : cachedPosition_;
+	}
+
+	AudioPlaybackCallback::AudioPlaybackCallback(Sound::SampleCache* sampleCache)
+		: sampleCache_(sampleCache)
 	{
 	}
 
 	AudioPlaybackCallback::~AudioPlaybackCallback()
 	{
+		if(loaderCounter_)
+			Job::Manager::WaitForCounter(loaderCounter_, 0);
+		if(cacheCounter_)
+			Job::Manager::WaitForCounter(cacheCounter_, 0);
+		WaitForCallback();
+
+		if(streamerThread_)
+		{
+			Core::AtomicExchg(&streamerExit_, 1);
+			streamerThread_.Join();
+		}
+
+		delete requested_;
+		delete pending_;
+		delete current_;
+		delete retired_;
 	}
 
 	void AudioPlaybackCallback::OnAudioCallback(i32 numIn, i32 numOut, const f32** in, f32** out, i32 numFrames)
 	{
-		if(numOut > 0)
+		Core::AtomicInc(&callbackEpoch_);
+
+		// Swap in a newly opened source, once the streamer has freed the last one we replaced.
+		if(pending_ && !retired_)
+		{
+			auto* source = static_cast<PlaybackSource*>(Core::AtomicExchgPtr((void* volatile*)&pending_, nullptr));
+			auto* oldSource = static_cast<PlaybackSource*>(Core::AtomicExchgPtr((void* volatile*)&current_, source));
+			Core::AtomicExchgPtr((void* volatile*)&retired_, oldSource);
+
+			Core::AtomicExchg(&seekFrame_, (i64)-1);
+			Core::AtomicExchg(&numFrames_, source->numFrames_);
+			Core::AtomicExchg(&sampleRate_, source->sampleRate_);
+			Core::AtomicExchg(&position_, (i64)0);
+			Core::AtomicExchg(&underruns_, 0);
+			Core::AtomicExchg(&active_, source->numFrames_ > 0 ? 1 : 0);
+		}
+
+		PlaybackSource* source = current_;
+		if(numOut > 0 && active_)
 		{
-			if(soundData_)
+			// Streamer wants to seek, discard what's buffered.
+			if(source->flush_ == 1)
 			{
-				auto* sampleData = reinterpret_cast<f32*>(soundData_.rawData_);
-				for(i32 i = 0; i < numFrames; ++i)
+				source->ring_.Skip(source->ring_.GetNumReadable());
+				Core::AtomicExchg(&source->flush_, 2);
+			}
+
+			if(source->flush_ == 0)
+			{
+				const i32 numChannels = source->numChannels_;
+				f32* readBuffer = source->readBuffer_.data();
+				for(i32 offset = 0; offset < numFrames; )
 				{
-					f32 sample = sampleData[currSample_];
-					currSample_++;
-					if(currSample_ > soundData_.numSamples_)
+					const i32 numToRead = Core::Min(numFrames - offset, READ_BLOCK_FRAMES);
+					const i32 numRead = source->ring_.Read(readBuffer, numToRead * numChannels) / numChannels;
+					if(numRead == 0)
 					{
-						currSample_ = 0;
+						Core::AtomicInc(&underruns_);
+						break;
 					}
 
-					for(i32 j = 0; j < numOut; ++j)
+					for(i32 i = 0; i < numRead; ++i)
 					{
-						out[j][i] += sample;
+						const f32* frame = readBuffer + i * numChannels;
+						for(i32 j = 0; j < numOut; ++j)
+						{
+							out[j][offset + i] += frame[j % numChannels];
+						}
 					}
+					offset += numRead;
 				}
+
+				const f64 ratio = source->resampler_ ? source->resampler_->GetRatio() : 1.0;
+				const i64 position = source->streamPosition_ - (i64)((source->ring_.GetNumReadable() / numChannels) * ratio);
+				Core::AtomicExchg(&position_, (position + source->numFrames_) % source->numFrames_);
 			}
 		}
+		Core::AtomicInc(&callbackEpoch_);
 	}
 
 	void AudioPlaybackCallback::Play(const char* fileName)
 	{
-		auto file = Core::File(fileName, Core::FileFlags::READ);
-		if(file)
+		Request(new PlaybackSource(fileName));
+	}
+
+	void AudioPlaybackCallback::Stop()
+	{
+		Request(new PlaybackSource(nullptr));
+	}
+
+	void AudioPlaybackCallback::Seek(i64 frame)
+	{
+		if(active_)
+			Core::AtomicExchg(&seekFrame_, Core::Max((i64)0, Core::Min(frame, numFrames_ - 1)));
+	}
+
+	void AudioPlaybackCallback::Request(PlaybackSource* source)
+	{
+		if(!streamerThread_)
+			streamerThread_ = Core::Thread(StreamerThread, this, Core::Thread::DEFAULT_STACK_SIZE, "Playback Streamer");
+
+		// The loader hasn't picked up the previous request yet, so it's superseded.
+		delete static_cast<PlaybackSource*>(Core::AtomicExchgPtr((void* volatile*)&requested_, source));
+
+		if(Core::AtomicCmpExchg(&loading_, 1, 0) == 0)
+		{
+			if(loaderCounter_)
+				Job::Manager::WaitForCounter(loaderCounter_, 0);
+
+			Job::JobDesc jobDesc;
+			jobDesc.func_ = [](i32 param, void* data) {
+				static_cast<AudioPlaybackCallback*>(data)->RunLoader();
+			};
+			jobDesc.param_ = 0;
+			jobDesc.data_ = this;
+			jobDesc.name_ = "Playback load";
+			Job::Manager::RunJobs(&jobDesc, 1, &loaderCounter_);
+		}
+	}
+
+	void AudioPlaybackCallback::RunLoader()
+	{
+		const i32 deviceSampleRate = App::Manager::GetSettings().audioSettings_.sampleRate_;
+		while(true)
 		{
-			auto data = Sound::Load(file);
-			if(data)
+			auto* source = static_cast<PlaybackSource*>(Core::AtomicExchgPtr((void* volatile*)&requested_, nullptr));
+			if(!source)
 			{
-				Core::ScopedMutex lock(soundDataMutex_);
-				soundData_ = std::move(data);
-				currSample_ = 0;
-			}			
+				Core::AtomicExchg(&loading_, 0);
+
+				// Pick up anything requested after the check above, as it won't have started a job.
+				if(!requested_ || Core::AtomicCmpExchg(&loading_, 1, 0) != 0)
+					return;
+				continue;
+			}
+
+			// Failed sources are still posted, so playback stops as it did before.
+			if(source->Open(sampleCache_, deviceSampleRate) && source->inputStream_ && sampleCache_ &&
+				(i64)sizeof(f32) * source->numFrames_ * source->numChannels_ <= sampleCache_->GetBudget())
+				CacheInBackground(source->fileName_.data());
+
+			// Never seen by the audio thread if it's still in the mailbox.
+			delete static_cast<PlaybackSource*>(Core::AtomicExchgPtr((void* volatile*)&pending_, source));
 		}
 	}
+	void AudioPlaybackCallback::CacheInBackground(const char* fileName)
+	{
+		if(Core::AtomicCmpExchg(&caching_, 1, 0) != 0)
+			return;
 
-	void AudioPlaybackCallback::Stop()
+		if(cacheCounter_)
+			Job::Manager::WaitForCounter(cacheCounter_, 0);
+		strcpy_s(cacheFileName_.data(), cacheFileName_.size(), fileName);
+
+		Job::JobDesc jobDesc;
+		jobDesc.func_ = [](i32 param, void* data) {
+			auto* callback = static_cast<AudioPlaybackCallback*>(data);
+			// Reference is dropped straight away, the sound stays cached until evicted.
+			callback->sampleCache_->Get(callback->cacheFileName_.data());
+			Core::AtomicExchg(&callback->caching_, 0);
+		};
+		jobDesc.param_ = 0;
+		jobDesc.data_ = this;
+		jobDesc.name_ = "SampleCache decode";
+		Job::Manager::RunJobs(&jobDesc, 1, &cacheCounter_);
+	}
+
+	void AudioPlaybackCallback::WaitForCallback() const
 	{
-		Core::ScopedMutex lock(soundDataMutex_);
-		std::swap(soundData_, Sound::Data());
-		currSample_ = 0;
+		const i32 epoch = callbackEpoch_;
+		if(epoch & 1)
+		{
+			while(callbackEpoch_ == epoch)
+				Core::Sleep(0.0005);
+		}
 	}
 
+	int AudioPlaybackCallback::StreamerThread(void* userData)
+	{
+		auto* callback = static_cast<AudioPlaybackCallback*>(userData);
+		while(callback->streamerExit_ == 0)
+		{
+			// Free what the audio thread swapped out before looking at the current source, so it's never in use here.
+			delete static_cast<PlaybackSource*>(Core::AtomicExchgPtr((void* volatile*)&callback->retired_, nullptr));
+
+			PlaybackSource* source = callback->current_;
+			if(source && source->numFrames_ > 0)
+			{
+				// Request a flush, and once the audio thread has emptied the ring buffer, seek & refill.
+				if(callback->seekFrame_ >= 0 && source->flush_ == 0)
+				{
+					Core::AtomicExchg(&source->flush_, 1);
+				}
+				else if(source->flush_ == 2)
+				{
+					const i64 frame = Core::AtomicExchg(&callback->seekFrame_, (i64)-1);
+					if(frame >= 0)
+					{
+						source->Seek(frame);
+						if(source->resampler_)
+							source->resampler_->Reset();
+						Core::AtomicExchg(&source->streamPosition_, frame);
+					}
+					source->Fill();
+					Core::AtomicExchg(&source->flush_, 0);
+				}
+
+				if(source->flush_ == 0)
+				{
+					while(source->Fill())
+					{
+					}
+				}
+			}
+			Core::Sleep(STREAMER_SLEEP);
+		}
+		return 0;
+	}
 
 } // namespace Callbacks
@@ -1,26 +1,110 @@
 #pragma once
 
 #include "audio_backend.h"
+#include "core/array.h"
 #include "core/concurrency.h"
-#include "core/vector.h"
-#include "sound.h"
+#include "sample_cache.h"
+
+namespace Job
+{
+	class Counter;
+} // namespace Job
 
 namespace Callbacks
 {
-	/// Handles automatic recording to disc.
+	struct PlaybackSource;
+
+	/**
+	 * Plays back sounds, streamed from disk.
+	 * With a sample cache, recently played sounds play straight from memory, and others are
+	 * decoded into the cache in the background while streaming.
+	 *
+	 * Sounds are opened & primed on a job, then handed to the audio thread through a single slot
+	 * mailbox. The audio thread swaps them in without locking, and the sound it replaces is freed
+	 * by the streamer thread.
+	 */
 	class AudioPlaybackCallback : public IAudioCallback
 	{
 	public:
-		AudioPlaybackCallback();
+		/// Frames read from disk at a time, and number of blocks buffered ahead of the audio thread.
+		static const i32 STREAM_BLOCK_FRAMES = 4096;
+		static const i32 STREAM_NUM_BLOCKS = 16;
+
+		AudioPlaybackCallback(Sound::SampleCache* sampleCache = nullptr);
 		virtual ~AudioPlaybackCallback();
 		void OnAudioCallback(i32 numIn, i32 numOut, const f32** in, f32** out, i32 numFrames) override;
+		const char* GetName() const override { return "Playback"; }
+
+		/**
+		 * Start playing @a fileName. Returns immediately, playback starts once the sound is opened.
+		 */
 		void Play(const char* fileName);
+
+		/**
+		 * Stop playing. Returns immediately, playback stops on the next audio block.
+		 */
 		void Stop();
 
+		/**
+		 * Seek to frame. Buffered audio is discarded & refilled in the background.
+		 */
+		void Seek(i64 frame);
+
+		bool IsPlaying() const { return active_ != 0; }
+		i64 GetPosition() const { return position_; }
+		i64 GetNumFrames() const { return numFrames_; }
+		i32 GetSampleRate() const { return sampleRate_; }
+		/// Number of times the audio thread has run out of streamed data.
+		i32 GetUnderruns() const { return underruns_; }
+
 	private:
-		mutable Core::Mutex soundDataMutex_;
-		Sound::Data soundData_;
-		i32 currSample_ = currSample_;
+		static int StreamerThread(void* userData);
+
+		/// Queue @a source to be opened by the loader job, replacing any request not yet picked up.
+		void Request(PlaybackSource* source);
+
+		/// Open, prime & post queued requests until there are none left.
+		void RunLoader();
+
+		/// Decode @a fileName into the sample cache on a job, if nothing else is being decoded.
+		void CacheInBackground(const char* fileName);
+
+		/// Wait for any in flight callback to complete.
+		void WaitForCallback() const;
+
+		/// Request waiting for the loader job.
+		PlaybackSource* volatile requested_ = nullptr;
+		/// Opened source waiting for the audio thread.
+		PlaybackSource* volatile pending_ = nullptr;
+		/// Source being played. Swapped by the audio thread, filled by the streamer thread.
+		PlaybackSource* volatile current_ = nullptr;
+		/// Source replaced by the audio thread, waiting for the streamer thread to free it.
+		PlaybackSource* volatile retired_ = nullptr;
+
+		Job::Counter* loaderCounter_ = nullptr;
+		/// 1 while the loader job is running.
+		volatile i32 loading_ = 0;
+
+		Core::Thread streamerThread_;
+		volatile i32 streamerExit_ = 0;
+
+		/// Requested seek frame, or -1.
+		volatile i64 seekFrame_ = -1;
+
+		/// State of the current source, published by the audio thread.
+		volatile i32 active_ = 0;
+		volatile i64 numFrames_ = 0;
+		volatile i32 sampleRate_ = 0;
+		volatile i64 position_ = 0;
+		/// Odd while the audio thread is in OnAudioCallback.
+		volatile i32 callbackEpoch_ = 0;
+		volatile i32 underruns_ = 0;
+
+		Sound::SampleCache* sampleCache_ = nullptr;
+		Core::Array<char, Core::MAX_PATH_LENGTH> cacheFileName_;
+		Job::Counter* cacheCounter_ = nullptr;
+		/// 1 while a cache job is in flight.
+		volatile i32 caching_ = 0;
 	};
 
 } // namespace Callbacks
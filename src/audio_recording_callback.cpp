@@ -1,26 +1,40 @@
 #include "audio_recording_callback.h"
+#include "audio_rt_check.h"
 #include "audio_stats_callback.h"
+#include "recording_catalog.h"
 #include "sound.h"
 #include "app.h"
 
+#include "core/array.h"
+#include "core/string.h"
 #include "job/manager.h"
 
 #include <utility>
 
 namespace Callbacks
 {
-	AudioRecordingCallback::AudioRecordingCallback(AudioStatsCallback& audioStats)
+	AudioRecordingCallback::AudioRecordingCallback(AudioStatsCallback& audioStats, RecordingCatalog* catalog)
 		: audioStats_(audioStats)
+		, catalog_(catalog)
+		, savingStreams_(MAX_SAVING_STREAMS)
 	{
 	}
 
 	AudioRecordingCallback::~AudioRecordingCallback()
 	{
-		if(outputStreamCounter_)
-		{
-			Job::Manager::WaitForCounter(outputStreamCounter_, 0);
-		}
+		// Wait for jobs, then claim them so nothing is left queued.
+		while(Core::AtomicCmpExchg(&preparing_, 1, 0) != 0)
+			Core::Sleep(0.001);
+		while(Core::AtomicCmpExchg(&saving_, 1, 0) != 0)
+			Core::Sleep(0.001);
+		SaveStreams();
 		delete outputStream_;
+
+		delete standbyStream_;
+
+		delete preRoll_;
+		delete preRollPending_;
+		delete preRollRetired_;
 	}
 
 	void AudioRecordingCallback::OnAudioCallback(i32 numIn, i32 numOut, const f32** in, f32** out, i32 numFrames)
@@ -29,11 +43,76 @@ namespace Callbacks
 
 		if(numIn > 0)
 		{
-			bool shouldStart = Core::AtomicCmpExchg(&startSignal_, 0, 1) == 1;
-			if(outputStream_ == nullptr && (shouldStart || audioStats_.max_ > thresholdStart_))
+			// Pick up pre-roll resized by the prepare job, once the previous one has been freed.
+			if(preRollPending_ && !preRollRetired_)
+			{
+				if(PreRoll* preRoll = static_cast<PreRoll*>(Core::AtomicExchgPtr((void* volatile*)&preRollPending_, nullptr)))
+				{
+					Core::AtomicExchgPtr((void* volatile*)&preRollRetired_, preRoll_);
+					preRoll_ = preRoll;
+				}
+			}
+
+			// Creating streams & resizing pre-roll allocates, so leave it to a job.
+			const i32 preRollFrames = (i32)(preRollTime_ * sampleRate);
+			const bool perTrack = mode_ == RecordingMode::PER_TRACK && numIn > 1;
+			const bool compressed = compressed_;
+			const bool isPrepared = numIn == prepareChannels_ && sampleRate == prepareSampleRate_ && preRollFrames == prepareFrames_ &&
+				perTrack == preparePerTrack_ && compressed == prepareCompressed_;
+			// A retired pre-roll can't be freed until its stream has written it, so check back now & again.
+			bool isRetiredWaiting = false;
+			if(preRollPending_ && preRollRetired_)
+			{
+				retiredWaitFrames_ += numFrames;
+				isRetiredWaiting = retiredWaitFrames_ >= sampleRate / RETIRED_CHECKS_PER_SECOND;
+			}
+			if((!isPrepared || standbyStream_ == nullptr || isRetiredWaiting) && Core::AtomicCmpExchg(&preparing_, 1, 0) == 0)
+			{
+				retiredWaitFrames_ = 0;
+				prepareChannels_ = numIn;
+				prepareSampleRate_ = sampleRate;
+				prepareFrames_ = preRollFrames;
+				preparePerTrack_ = perTrack;
+				prepareCompressed_ = compressed;
+
+				Job::JobDesc jobDesc;
+				jobDesc.func_ = [](i32 param, void* data) {
+					AudioRecordingCallback* callback = static_cast<AudioRecordingCallback*>(data);
+					callback->Prepare();
+					// Last access, the destructor may run as soon as this is cleared.
+					Core::AtomicExchg(&callback->preparing_, 0);
+				};
+				jobDesc.param_ = 0;
+				jobDesc.data_ = this;
+				jobDesc.name_ = "AudioRecordingCallback prepare";
+				RT_CHECK(SYSCALL);
+				Job::Manager::RunJobs(&jobDesc, 1, nullptr);
+			}
+
+			// Standby stream matches the current settings if nothing has changed since it was requested.
+			// Otherwise wait for the prepare job to replace it, rather than start with the wrong channels.
+			const bool isStandbyReady = isPrepared && preparing_ == 0 && standbyStream_ != nullptr;
+			if(outputStream_ == nullptr && isStandbyReady &&
+				(Core::AtomicCmpExchg(&startSignal_, 0, 1) == 1 || audioStats_.max_ > thresholdStart_))
 			{
-				outputStream_ = new Sound::OutputStream(sampleRate);
+				// Record every enabled input.
+				outputStream_ = static_cast<Sound::OutputStream*>(Core::AtomicExchgPtr((void* volatile*)&standbyStream_, nullptr));
+				outputStream_->Start();
+				stallTolerance_ = outputStream_->GetStallTolerance();
 				remainingTimeToStop_ = timeout_;
+
+				// Hand over what came before the trigger, & carry on with the spare.
+				if(preRoll_)
+				{
+					PreRollBuffer& preRoll = preRoll_->buffers_[preRoll_->idx_];
+					if(!preRoll.IsInUse() && !preRoll_->stale_ && preRoll.GetNumFrames() > 0)
+					{
+						preRoll.Acquire();
+						outputStream_->SetPreRoll(&preRoll);
+						preRoll_->idx_ = (preRoll_->idx_ + 1) % preRoll_->buffers_.size();
+						preRoll_->stale_ = true;
+					}
+				}
 			}
 
 			// If automatic stopping is enabled, then count towards it.
@@ -57,34 +136,114 @@ namespace Callbacks
 			// Create and push to sound buffer.
 			if(outputStream_ != nullptr)
 			{
-				outputStream_->Push(in[0], sizeof(f32) * numFrames);
+				outputStream_->Push(in, numFrames);
+				Core::AtomicExchg(&numDroppedBlocks_, prevDroppedBlocks_ + outputStream_->GetNumDroppedBlocks());
 
-				// If we need to save, kick of a job to delete and finalize.
-				if(Core::AtomicCmpExchg(&stopSignal_, 0, 1) == 1)
+				// If we need to save, queue for the save job. Should it fall that far behind, keep recording until there's room.
+				if(stopSignal_ != 0 && savingStreams_.GetNumWritable() > 0)
 				{
-					if(outputStreamCounter_)
-					{
-						Job::Manager::WaitForCounter(outputStreamCounter_, 0);
-					}
+					Core::AtomicExchg(&stopSignal_, 0);
+					prevDroppedBlocks_ += outputStream_->GetNumDroppedBlocks();
+					savingStreams_.Write(&outputStream_, 1);
+					outputStream_ = nullptr;
+
+					remainingTimeToStop_ = timeout_;
+				}
+			}
+
+			// Also catches streams queued just as a previous save job was finishing.
+			if(savingStreams_.GetNumReadable() > 0 && Core::AtomicCmpExchg(&saving_, 1, 0) == 0)
+			{
+				Job::JobDesc jobDesc;
+				jobDesc.func_ = [](i32 param, void* data) {
+					AudioRecordingCallback* callback = static_cast<AudioRecordingCallback*>(data);
+					callback->SaveStreams();
+					// Last access, the destructor may run as soon as this is cleared.
+					Core::AtomicExchg(&callback->saving_, 0);
+				};
+				jobDesc.param_ = 0;
+				jobDesc.data_ = this;
+				jobDesc.name_ = "Sound::OutputStream save";
+				RT_CHECK(SYSCALL);
+				Job::Manager::RunJobs(&jobDesc, 1, nullptr);
+			}
 
-					Job::JobDesc jobDesc;
-					jobDesc.func_ = [](i32 param, void* data) {
-						Sound::OutputStream* outputStream = static_cast<Sound::OutputStream*>(data);
-						delete outputStream;
-					};
+			// Keep pre-roll up to date while waiting, unless the stream still needs it.
+			if(outputStream_ == nullptr && preRoll_)
+			{
+				PreRollBuffer& preRoll = preRoll_->buffers_[preRoll_->idx_];
+				if(!preRoll.IsInUse() && preRoll.GetNumChannels() == numIn)
+				{
+					if(preRoll_->stale_)
+						preRoll.Reset();
+					preRoll_->stale_ = false;
+					preRoll.Write(in, numFrames);
+				}
+			}
+		}
+	}
 
-					Core::ScopedMutex lock(recordingMutex_);
-					recordingIds_.push_back(outputStream_->GetID());
+	void AudioRecordingCallback::Prepare()
+	{
+		// Replace the standby stream if settings have changed.
+		Sound::OutputStream* standbyStream = static_cast<Sound::OutputStream*>(Core::AtomicExchgPtr((void* volatile*)&standbyStream_, nullptr));
+		if(standbyStream && (standbyStream->GetNumChannels() != prepareChannels_ || standbyStream->GetSampleRate() != prepareSampleRate_ ||
+			standbyStream->IsPerTrack() != preparePerTrack_ || standbyStream->IsCompressed() != prepareCompressed_))
+		{
+			delete standbyStream;
+			standbyStream = nullptr;
+		}
+		if(!standbyStream)
+			standbyStream = new Sound::OutputStream(prepareSampleRate_, prepareChannels_, preparePerTrack_, prepareCompressed_);
+		Core::AtomicExchgPtr((void* volatile*)&standbyStream_, standbyStream);
 
-					jobDesc.param_ = 0;
-					jobDesc.data_ = outputStream_;
-					jobDesc.name_ = "Sound::OutputStream save";
-					Job::Manager::RunJobs(&jobDesc, 1, &outputStreamCounter_);
+		// Previous pre-roll may still be being written by a stream. Rather than wait, leave it for the
+		// audio thread to ask again.
+		if(PreRoll* retired = preRollRetired_)
+		{
+			bool isInUse = false;
+			for(auto& buffer : retired->buffers_)
+				isInUse |= buffer.IsInUse();
+			if(!isInUse)
+			{
+				delete retired;
+				Core::AtomicExchgPtr((void* volatile*)&preRollRetired_, nullptr);
+			}
+		}
 
-					outputStream_ = nullptr;
+		if(prepareChannels_ != preparedChannels_ || prepareFrames_ != preparedFrames_)
+		{
+			preparedChannels_ = prepareChannels_;
+			preparedFrames_ = prepareFrames_;
 
-					remainingTimeToStop_ = timeout_;
-				}
+			// Replace any pre-roll the audio thread hasn't picked up yet.
+			delete static_cast<PreRoll*>(Core::AtomicExchgPtr((void* volatile*)&preRollPending_, nullptr));
+
+			PreRoll* preRoll = new PreRoll();
+			for(auto& buffer : preRoll->buffers_)
+				buffer.Resize(preparedChannels_, preparedFrames_);
+			Core::AtomicExchgPtr((void* volatile*)&preRollPending_, preRoll);
+		}
+	}
+
+	void AudioRecordingCallback::SaveStreams()
+	{
+		Sound::OutputStream* outputStream = nullptr;
+		while(savingStreams_.Read(&outputStream, 1) == 1)
+		{
+			Core::Vector<Core::String> fileNames;
+			for(i32 idx = 0; idx < outputStream->GetNumFiles(); ++idx)
+			{
+				Core::Array<char, Core::MAX_PATH_LENGTH> fileName;
+				outputStream->GetFileName(idx, fileName.data(), fileName.size());
+				fileNames.push_back(fileName.data());
+			}
+			delete outputStream;
+
+			if(catalog_)
+			{
+				for(const auto& fileName : fileNames)
+					catalog_->Add(fileName.c_str());
 			}
 		}
 	}
@@ -99,10 +258,4 @@ namespace Callbacks
 		Core::AtomicExchg(&stopSignal_, 1);
 	}
 
-	Core::Vector<i32> AudioRecordingCallback::GetRecordingIDs() const
-	{
-		Core::ScopedMutex lock(recordingMutex_);
-		return recordingIds_;
-	}
-
 } // namespace Callbacks
@@ -1,35 +1,44 @@
 #pragma once
 
 #include "audio_backend.h"
+#include "core/array.h"
 #include "core/concurrency.h"
 #include "core/vector.h"
-
-namespace Job
-{
-	struct Counter;
-} // namespace Job
+#include "pre_roll_buffer.h"
+#include "ring_buffer.h"
 
 namespace Sound
 {
 	class OutputStream;
 } // namespace Sound
 
+class RecordingCatalog;
+
 namespace Callbacks
 {
 	class AudioStatsCallback;
 
+	/// How multichannel input is written to disc.
+	enum class RecordingMode : i32
+	{
+		/// One multichannel file.
+		INTERLEAVED = 0,
+		/// One mono file per input channel.
+		PER_TRACK,
+	};
+
 	/// Handles automatic recording to disc.
 	class AudioRecordingCallback : public IAudioCallback
 	{
 	public:
-		AudioRecordingCallback(AudioStatsCallback& audioStats);
+		/// @param catalog Catalog to add finished recordings to, optional.
+		AudioRecordingCallback(AudioStatsCallback& audioStats, RecordingCatalog* catalog = nullptr);
 		virtual ~AudioRecordingCallback();
 		void OnAudioCallback(i32 numIn, i32 numOut, const f32** in, f32** out, i32 numFrames) override;
+		const char* GetName() const override { return "Recording"; }
 		void Start();
 		void Stop();
 
-		Core::Vector<i32> GetRecordingIDs() const;
-
 		bool IsRecording() const { return outputStream_ != nullptr; }
 		f32 RecordingTimeLeft() const { return remainingTimeToStop_; }
 
@@ -45,11 +54,53 @@ namespace Callbacks
 		f32 GetThresholdStop() const { return thresholdStop_; }
 		void SetThresholdStop(f32 val) { thresholdStop_ = val; }
 
+		/// Mode is applied when the next recording starts.
+		RecordingMode GetMode() const { return mode_; }
+		void SetMode(RecordingMode mode) { mode_ = mode; }
+
+		bool GetCompressed() const { return compressed_; }
+		void SetCompressed(bool compressed) { compressed_ = compressed; }
+
+		/// Seconds of input before the trigger to include in recordings. Applied while waiting to record,
+		/// once a job has resized the pre-roll.
+		f32 GetPreRollTime() const { return preRollTime_; }
+		void SetPreRollTime(f32 val) { preRollTime_ = val; }
+
+		/// Blocks of input dropped because writing to disk fell behind, across all recordings.
+		i32 GetNumDroppedBlocks() const { return numDroppedBlocks_; }
+		/// Seconds writing to disk can stall for before input is dropped.
+		f32 GetStallTolerance() const { return stallTolerance_; }
+
 	private:
+		/// Pre-roll buffer, and a spare to carry on with while the other is written out.
+		struct PreRoll
+		{
+			Core::Array<PreRollBuffer, 2> buffers_;
+			i32 idx_ = 0;
+			/// Current buffer was handed out previously, & needs clearing once released.
+			bool stale_ = false;
+		};
+
+		/// Job: build the standby stream & resize pre-roll as requested, off the audio thread.
+		void Prepare();
+		/// Job: finalise finished streams & add them to the catalog.
+		void SaveStreams();
+
+		/// Finished streams waiting for the save job.
+		static const i32 MAX_SAVING_STREAMS = 16;
+		/// How often to ask the prepare job to retry freeing a retired pre-roll.
+		static const i32 RETIRED_CHECKS_PER_SECOND = 20;
+
 		AudioStatsCallback& audioStats_;
+		RecordingCatalog* catalog_ = nullptr;
 
 		Sound::OutputStream* outputStream_ = nullptr;
-		Job::Counter* outputStreamCounter_ = nullptr;
+		/// Stream built ahead of time by the prepare job, so starting to record doesn't allocate or open files.
+		Sound::OutputStream* volatile standbyStream_ = nullptr;
+		/// Finished streams, finalised in order by the save job.
+		RingBuffer<Sound::OutputStream*> savingStreams_;
+		/// 1 whilst the save job is running.
+		volatile i32 saving_ = 0;
 
 		/// Threshold volume to start recording.
 		f32 thresholdStart_ = 0.1f;
@@ -59,15 +110,43 @@ namespace Callbacks
 		f32 timeout_ = 2.0f;
 		/// Enable automatic stopping.
 		bool autoStop_ = true;
+		/// Recording mode.
+		RecordingMode mode_ = RecordingMode::INTERLEAVED;
+		/// Record to lossless compressed files.
+		bool compressed_ = false;
 
 		/// Remaining time to stop.
 		f32 remainingTimeToStop_ = 0.0f;
 
+		/// Input written while waiting to record.
+		f32 preRollTime_ = 1.0f;
+		/// Pre-roll in use by the audio thread.
+		PreRoll* preRoll_ = nullptr;
+		/// Built by the prepare job, swapped in by the audio thread.
+		PreRoll* volatile preRollPending_ = nullptr;
+		/// Swapped out by the audio thread, freed by the prepare job once no stream is reading it.
+		PreRoll* volatile preRollRetired_ = nullptr;
+		/// Settings last requested from the prepare job.
+		volatile i32 prepareChannels_ = 0;
+		volatile i32 prepareSampleRate_ = 0;
+		volatile i32 prepareFrames_ = -1;
+		volatile bool preparePerTrack_ = false;
+		volatile bool prepareCompressed_ = false;
+		/// Pre-roll size last built by the prepare job.
+		i32 preparedChannels_ = 0;
+		i32 preparedFrames_ = -1;
+		/// 1 whilst the prepare job is running.
+		volatile i32 preparing_ = 0;
+		/// Frames since the prepare job last tried to free the retired pre-roll.
+		i32 retiredWaitFrames_ = 0;
+
+		/// Dropped blocks from finished recordings, plus the current one's.
+		i32 prevDroppedBlocks_ = 0;
+		volatile i32 numDroppedBlocks_ = 0;
+		f32 stallTolerance_ = 0.0f;
+
 		volatile i32 startSignal_ = 0;
 		volatile i32 stopSignal_ = 0;
-
-		mutable Core::Mutex recordingMutex_;
-		Core::Vector<i32> recordingIds_;
 	};
 
 
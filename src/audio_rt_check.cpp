@@ -0,0 +1,252 @@
+#include "audio_rt_check.h"
+
+#include "core/concurrency.h"
+#include "core/debug.h"
+#include "core/misc.h"
+
+#include <cstdlib>
+#include <new>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define RT_CHECK_RETURN_ADDRESS() _ReturnAddress()
+#else
+#define RT_CHECK_RETURN_ADDRESS() __builtin_return_address(0)
+#endif
+
+namespace RTCheck
+{
+	namespace
+	{
+		struct ReportSlot
+		{
+			Report report_;
+			/// Set once report_ is filled in & visible to other threads.
+			volatile i32 valid_ = 0;
+			volatile i32 count_ = 0;
+		};
+
+		ReportSlot reports_[MAX_REPORTS];
+		volatile i32 numReports_ = 0;
+		volatile i32 numDropped_ = 0;
+		volatile i32 enabled_ = 1;
+
+		thread_local bool isRealtime_ = false;
+		thread_local bool isAllowed_ = false;
+		thread_local const char* callback_ = nullptr;
+
+		bool ShouldFlag()
+		{
+			return isRealtime_ && !isAllowed_ && enabled_ != 0;
+		}
+
+		bool Matches(const Report& report, Violation violation, const char* file, i32 line, void* address)
+		{
+			return report.violation_ == violation && report.callback_ == callback_ &&
+				report.file_ == file && report.line_ == line && report.address_ == address;
+		}
+	}
+
+	void SetEnabled(bool enabled)
+	{
+		Core::AtomicExchg(&enabled_, enabled ? 1 : 0);
+	}
+
+	bool IsEnabled()
+	{
+		return RT_CHECK_ENABLED && enabled_ != 0;
+	}
+
+	bool IsRealtimeThread()
+	{
+		return isRealtime_;
+	}
+
+	void Flag(Violation violation, const char* file, i32 line, void* address)
+	{
+		if(!ShouldFlag())
+			return;
+
+		// Existing call site?
+		const i32 numReports = Core::Min(numReports_, MAX_REPORTS);
+		for(i32 idx = 0; idx < numReports; ++idx)
+		{
+			auto& slot = reports_[idx];
+			if(slot.valid_ && Matches(slot.report_, violation, file, line, address))
+			{
+				Core::AtomicInc(&slot.count_);
+				return;
+			}
+		}
+
+		// New call site. Racing threads may add duplicates, which is harmless.
+		const i32 idx = Core::AtomicInc(&numReports_) - 1;
+		if(idx >= MAX_REPORTS)
+		{
+			Core::AtomicInc(&numDropped_);
+			return;
+		}
+
+		auto& slot = reports_[idx];
+		slot.report_.violation_ = violation;
+		slot.report_.callback_ = callback_;
+		slot.report_.file_ = file;
+		slot.report_.line_ = line;
+		slot.report_.address_ = address;
+		slot.count_ = 1;
+		Core::AtomicExchg(&slot.valid_, 1);
+	}
+
+	i32 GetReports(Report* outReports, i32 maxReports)
+	{
+		i32 numOut = 0;
+		const i32 numReports = Core::Min(numReports_, MAX_REPORTS);
+		for(i32 idx = 0; idx < numReports && numOut < maxReports; ++idx)
+		{
+			const auto& slot = reports_[idx];
+			if(slot.valid_)
+			{
+				outReports[numOut] = slot.report_;
+				outReports[numOut].count_ = slot.count_;
+				++numOut;
+			}
+		}
+		return numOut;
+	}
+
+	void ResetReports()
+	{
+		for(auto& slot : reports_)
+			slot.valid_ = 0;
+		Core::AtomicExchg(&numReports_, 0);
+		Core::AtomicExchg(&numDropped_, 0);
+	}
+
+	void LogReports()
+	{
+		Report reports[MAX_REPORTS];
+		const i32 numReports = GetReports(reports, MAX_REPORTS);
+		if(numReports == 0)
+		{
+			Core::Log("RTCheck: No realtime violations.\n");
+			return;
+		}
+
+		for(i32 idx = 0; idx < numReports; ++idx)
+		{
+			const auto& report = reports[idx];
+			if(report.file_)
+				Core::Log("RTCheck: %s in %s at %s(%d), %d times\n", GetViolationName(report.violation_),
+					report.callback_ ? report.callback_ : "dispatch", report.file_, report.line_, report.count_);
+			else
+				Core::Log("RTCheck: %s in %s from %p, %d times\n", GetViolationName(report.violation_),
+					report.callback_ ? report.callback_ : "dispatch", report.address_, report.count_);
+		}
+
+		if(numDropped_ > 0)
+			Core::Log("RTCheck: %d further violations not recorded.\n", numDropped_);
+	}
+
+	const char* GetViolationName(Violation violation)
+	{
+		switch(violation)
+		{
+		case Violation::ALLOCATION: return "Allocation";
+		case Violation::FREE: return "Free";
+		case Violation::LOCK: return "Lock";
+		case Violation::WAIT: return "Wait";
+		case Violation::FILE_IO: return "File I/O";
+		case Violation::SYSCALL: return "Syscall";
+		default: return "Unknown";
+		}
+	}
+
+	ScopedRealtime::ScopedRealtime()
+	{
+		prev_ = isRealtime_;
+		isRealtime_ = true;
+	}
+
+	ScopedRealtime::~ScopedRealtime()
+	{
+		isRealtime_ = prev_;
+	}
+
+	ScopedCallback::ScopedCallback(const char* name)
+	{
+		prev_ = callback_;
+		callback_ = name;
+	}
+
+	ScopedCallback::~ScopedCallback()
+	{
+		callback_ = prev_;
+	}
+
+	ScopedAllow::ScopedAllow()
+	{
+		prev_ = isAllowed_;
+		isAllowed_ = true;
+	}
+
+	ScopedAllow::~ScopedAllow()
+	{
+		isAllowed_ = prev_;
+	}
+
+} // namespace RTCheck
+
+#if RT_CHECK_ENABLED
+// Allocator hooks, flagging heap use on realtime threads.
+void* operator new(size_t size)
+{
+	RTCheck::Flag(RTCheck::Violation::ALLOCATION, nullptr, 0, RT_CHECK_RETURN_ADDRESS());
+	if(void* ptr = malloc(size ? size : 1))
+		return ptr;
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+	RTCheck::Flag(RTCheck::Violation::ALLOCATION, nullptr, 0, RT_CHECK_RETURN_ADDRESS());
+	if(void* ptr = malloc(size ? size : 1))
+		return ptr;
+	throw std::bad_alloc();
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	RTCheck::Flag(RTCheck::Violation::ALLOCATION, nullptr, 0, RT_CHECK_RETURN_ADDRESS());
+	return malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+	RTCheck::Flag(RTCheck::Violation::ALLOCATION, nullptr, 0, RT_CHECK_RETURN_ADDRESS());
+	return malloc(size ? size : 1);
+}
+
+void operator delete(void* ptr) noexcept
+{
+	if(ptr)
+		RTCheck::Flag(RTCheck::Violation::FREE, nullptr, 0, RT_CHECK_RETURN_ADDRESS());
+	free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+	if(ptr)
+		RTCheck::Flag(RTCheck::Violation::FREE, nullptr, 0, RT_CHECK_RETURN_ADDRESS());
+	free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+	free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+	free(ptr);
+}
+#endif
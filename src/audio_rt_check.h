@@ -0,0 +1,124 @@
+#pragma once
+
+#include "core/types.h"
+
+/// Realtime safety checking for the audio thread. Enabled by default in debug builds.
+#if !defined(RT_CHECK_ENABLED)
+#if !defined(NDEBUG)
+#define RT_CHECK_ENABLED 1
+#else
+#define RT_CHECK_ENABLED 0
+#endif
+#endif
+
+namespace RTCheck
+{
+	/// Operation which isn't safe to perform on a realtime thread.
+	enum class Violation
+	{
+		ALLOCATION = 0,
+		FREE,
+		LOCK,
+		WAIT,
+		FILE_IO,
+		SYSCALL,
+
+		MAX
+	};
+
+	/// Aggregated report of a violation at a single call site.
+	struct Report
+	{
+		Violation violation_ = Violation::MAX;
+		/// Name of callback running when violation occurred, or nullptr if outside of a callback.
+		const char* callback_ = nullptr;
+		/// Call site, if known.
+		const char* file_ = nullptr;
+		i32 line_ = 0;
+		/// Return address of call site, for allocations where file & line are unknown.
+		void* address_ = nullptr;
+		/// Number of times violation has occurred.
+		i32 count_ = 0;
+	};
+
+	/// Maximum number of unique reports stored.
+	static const i32 MAX_REPORTS = 64;
+
+	/**
+	 * Enable or disable checking at runtime. Has no effect if compiled out.
+	 */
+	void SetEnabled(bool enabled);
+	bool IsEnabled();
+
+	/**
+	 * Is the current thread marked as realtime?
+	 */
+	bool IsRealtimeThread();
+
+	/**
+	 * Flag a violation if the current thread is realtime.
+	 * Safe to call from any thread, and never allocates or locks.
+	 */
+	void Flag(Violation violation, const char* file, i32 line, void* address = nullptr);
+
+	/**
+	 * Copy out reports.
+	 * @return Number of reports written.
+	 */
+	i32 GetReports(Report* outReports, i32 maxReports);
+
+	/**
+	 * Clear reports. Violations flagged concurrently may be lost.
+	 */
+	void ResetReports();
+
+	/**
+	 * Write reports to the log.
+	 */
+	void LogReports();
+
+	const char* GetViolationName(Violation violation);
+
+	/**
+	 * Mark current thread as realtime for this scope.
+	 */
+	struct ScopedRealtime
+	{
+		ScopedRealtime();
+		~ScopedRealtime();
+		bool prev_ = false;
+	};
+
+	/**
+	 * Attribute violations in this scope to a callback.
+	 */
+	struct ScopedCallback
+	{
+		ScopedCallback(const char* name);
+		~ScopedCallback();
+		const char* prev_ = nullptr;
+	};
+
+	/**
+	 * Suppress violations in this scope, for operations known to be safe.
+	 */
+	struct ScopedAllow
+	{
+		ScopedAllow();
+		~ScopedAllow();
+		bool prev_ = false;
+	};
+
+} // namespace RTCheck
+
+#if RT_CHECK_ENABLED
+#define RT_CHECK(violation) RTCheck::Flag(RTCheck::Violation::violation, __FILE__, __LINE__)
+#define RT_CHECK_SCOPED_REALTIME() RTCheck::ScopedRealtime rtCheckScopedRealtime_
+#define RT_CHECK_SCOPED_CALLBACK(name) RTCheck::ScopedCallback rtCheckScopedCallback_(name)
+#define RT_CHECK_SCOPED_ALLOW() RTCheck::ScopedAllow rtCheckScopedAllow_
+#else
+#define RT_CHECK(violation)
+#define RT_CHECK_SCOPED_REALTIME()
+#define RT_CHECK_SCOPED_CALLBACK(name)
+#define RT_CHECK_SCOPED_ALLOW()
+#endif
@@ -1,7 +1,10 @@
 #include "audio_stats_callback.h"
+#include "app.h"
 #include "ispc/audio_stats_ispc.h"
 #include "core/misc.h"
 
+#include <cmath>
+
 namespace Callbacks
 {
 	AudioStatsCallback::AudioStatsCallback()
@@ -19,9 +22,12 @@ namespace Callbacks
 			rms_ = ispc::audio_stats_rms(in[0], numFrames);
 			max_ = ispc::audio_stats_max(in[0], numFrames);
 				
-			/// TODO: Lerp to 0.0 to scale for different buffer size/sample rate.
-			rmsSmoothed_ *= 0.99f;
-			maxSmoothed_ *= 0.99f;
+			// Decay per second rather than per block, so smoothing doesn't depend on block size or sample rate.
+			// Matches the original 0.99 per 1024 frame block at 48kHz.
+			const i32 sampleRate = Core::Max(App::Manager::GetSettings().audioSettings_.sampleRate_, 1);
+			const f32 decay = std::pow(0.99f, (f32)numFrames * (48000.0f / 1024.0f) / (f32)sampleRate);
+			rmsSmoothed_ *= decay;
+			maxSmoothed_ *= decay;
 
 			rmsSmoothed_ = Core::Max(rmsSmoothed_, rms_);
 			maxSmoothed_ = Core::Max(maxSmoothed_, max_);
@@ -12,6 +12,7 @@ namespace Callbacks
 		virtual ~AudioStatsCallback();
 
 		void OnAudioCallback(i32 numIn, i32 numOut, const f32** in, f32** out, i32 numFrames) override;
+		const char* GetName() const override { return "Stats"; }
 
 		f32 rms_ = 0.0f;
 		f32 max_ = 0.0f;
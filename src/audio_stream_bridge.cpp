@@ -0,0 +1,122 @@
+#include "audio_stream_bridge.h"
+#include "core/misc.h"
+
+#include <cstring>
+
+#include <cmath>
+
+namespace
+{
+	/// Maximum deviation from a 1:1 ratio. Real clocks are well within this.
+	const f64 MAX_RATIO_DEVIATION = 0.005;
+	/// Controller gains, relative to the target latency.
+	const f64 PROPORTIONAL_GAIN = 0.0005;
+	const f64 INTEGRAL_GAIN = 0.000002;
+	/// Smoothing applied to measured latency per block.
+	const f64 LATENCY_SMOOTHING = 0.02;
+
+	/// 4 point, 3rd order Hermite interpolation between y1 & y2.
+	f32 Hermite(f32 y0, f32 y1, f32 y2, f32 y3, f32 t)
+	{
+		const f32 c1 = 0.5f * (y2 - y0);
+		const f32 c2 = y0 - 2.5f * y1 + 2.0f * y2 - 0.5f * y3;
+		const f32 c3 = 0.5f * (y3 - y0) + 1.5f * (y1 - y2);
+		return ((c3 * t + c2) * t + c1) * t + y1;
+	}
+}
+
+AudioStreamBridge::AudioStreamBridge(i32 numChannels, i32 maxFrames, i32 targetLatency)
+	: numChannels_(numChannels)
+	, maxFrames_(maxFrames)
+	, targetLatency_(targetLatency)
+{
+	// Room for the target latency, plus a full block of slack either side.
+	ring_.Resize((targetLatency_ + maxFrames_ * 4) * numChannels_);
+	writeScratch_.resize(maxFrames_ * numChannels_);
+
+	// Reads may consume slightly more frames than they produce.
+	const i32 maxReadFrames = (i32)std::ceil(maxFrames_ * (1.0 + MAX_RATIO_DEVIATION)) + 1;
+	readScratch_.resize((HISTORY_FRAMES + maxReadFrames + 1) * numChannels_);
+
+	filteredLatency_ = targetLatency_;
+}
+
+AudioStreamBridge::~AudioStreamBridge()
+{
+}
+
+void AudioStreamBridge::Write(const f32* const* in, i32 numFrames)
+{
+	for(i32 offset = 0; offset < numFrames; offset += maxFrames_)
+	{
+		const i32 blockFrames = Core::Min(maxFrames_, numFrames - offset);
+		f32* scratch = writeScratch_.data();
+		for(i32 i = 0; i < blockFrames; ++i)
+			for(i32 ch = 0; ch < numChannels_; ++ch)
+				*scratch++ = in[ch][offset + i];
+
+		// Output side has stalled, drop what doesn't fit.
+		const i32 numSamples = blockFrames * numChannels_;
+		if(ring_.Write(writeScratch_.data(), numSamples) < numSamples)
+			overruns_ = overruns_ + 1;
+	}
+}
+
+void AudioStreamBridge::Read(f32** out, i32 numFrames)
+{
+	// Wait for the queue to fill before consuming anything.
+	if(!primed_)
+	{
+		primed_ = GetQueuedFrames() >= targetLatency_;
+		if(!primed_)
+		{
+			for(i32 ch = 0; ch < numChannels_; ++ch)
+				memset(out[ch], 0, sizeof(f32) * numFrames);
+			return;
+		}
+	}
+
+	UpdateRatio();
+
+	// Frames to advance by this block. Interpolation needs the history plus these.
+	const f64 endPosition = position_ + numFrames * ratio_;
+	const i32 numNeeded = (i32)endPosition;
+	f32* history = readScratch_.data();
+	f32* incoming = history + HISTORY_FRAMES * numChannels_;
+	const i32 numRead = ring_.Read(incoming, numNeeded * numChannels_) / numChannels_;
+	if(numRead < numNeeded)
+	{
+		// Starved, hold the last frame and re-prime.
+		const f32* lastFrame = incoming + (numRead - 1) * numChannels_;
+		for(i32 i = numRead; i < numNeeded; ++i)
+			memcpy(incoming + i * numChannels_, lastFrame, sizeof(f32) * numChannels_);
+		underruns_ = underruns_ + 1;
+		primed_ = false;
+	}
+
+	for(i32 i = 0; i < numFrames; ++i)
+	{
+		const f64 position = position_ + i * ratio_;
+		const i32 idx = (i32)position;
+		const f32 t = (f32)(position - idx);
+		const f32* frame = history + idx * numChannels_;
+		for(i32 ch = 0; ch < numChannels_; ++ch)
+		{
+			out[ch][i] = Hermite(frame[ch], frame[ch + numChannels_], frame[ch + numChannels_ * 2], frame[ch + numChannels_ * 3], t);
+		}
+	}
+
+	// Keep the last frames around for the next block.
+	position_ = endPosition - numNeeded;
+	memmove(history, history + numNeeded * numChannels_, sizeof(f32) * HISTORY_FRAMES * numChannels_);
+}
+
+void AudioStreamBridge::UpdateRatio()
+{
+	// Queue growing means input is running fast relative to output, so consume faster.
+	filteredLatency_ += (GetQueuedFrames() - filteredLatency_) * LATENCY_SMOOTHING;
+	const f64 error = (filteredLatency_ - targetLatency_) / targetLatency_;
+	integral_ = Core::Clamp(integral_ + error, -MAX_RATIO_DEVIATION / INTEGRAL_GAIN, MAX_RATIO_DEVIATION / INTEGRAL_GAIN);
+	const f64 deviation = error * PROPORTIONAL_GAIN + integral_ * INTEGRAL_GAIN;
+	ratio_ = 1.0 + Core::Clamp(deviation, -MAX_RATIO_DEVIATION, MAX_RATIO_DEVIATION);
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "core/types.h"
+#include "core/vector.h"
+#include "ring_buffer.h"
+
+/**
+ * Joins an input stream to an output stream running from an independent clock.
+ * Input frames are queued in a lock-free ring buffer, and the output side resamples
+ * them by a ratio adapted to keep the queue at a constant fill level, compensating for
+ * drift between the two clocks.
+ */
+class AudioStreamBridge
+{
+public:
+	/**
+	 * @param numChannels Number of channels to bridge.
+	 * @param maxFrames Maximum frames per Read call.
+	 * @param targetLatency Number of frames to keep queued.
+	 */
+	AudioStreamBridge(i32 numChannels, i32 maxFrames, i32 targetLatency);
+	~AudioStreamBridge();
+
+	/**
+	 * Input stream: queue non-interleaved frames.
+	 */
+	void Write(const f32* const* in, i32 numFrames);
+
+	/**
+	 * Output stream: produce non-interleaved frames, resampled to compensate for drift.
+	 * @pre numFrames <= maxFrames.
+	 */
+	void Read(f32** out, i32 numFrames);
+
+	i32 GetMaxFrames() const { return maxFrames_; }
+	f32 GetRatio() const { return (f32)ratio_; }
+	i32 GetQueuedFrames() const { return ring_.GetNumReadable() / numChannels_; }
+	i32 GetUnderruns() const { return underruns_; }
+	i32 GetOverruns() const { return overruns_; }
+
+private:
+	/// Number of frames of history kept for interpolation.
+	static const i32 HISTORY_FRAMES = 3;
+
+	void UpdateRatio();
+
+	i32 numChannels_ = 0;
+	i32 maxFrames_ = 0;
+	i32 targetLatency_ = 0;
+
+	/// Interleaved input frames.
+	RingBuffer<f32> ring_;
+	/// Interleaved scratch for interleaving writes.
+	Core::Vector<f32> writeScratch_;
+	/// Interleaved scratch for reads, with history frames at the start.
+	Core::Vector<f32> readScratch_;
+
+	/// Output side state.
+	bool primed_ = false;
+	f64 position_ = 0.0;
+	f64 ratio_ = 1.0;
+	f64 filteredLatency_ = 0.0;
+	f64 integral_ = 0.0;
+
+	volatile i32 underruns_ = 0;
+	volatile i32 overruns_ = 0;
+};
@@ -49,6 +49,41 @@ namespace
 		4096,
 	};
 
+	const char* quantumStrs[] =
+	{
+		"Device",
+		"32",
+		"64",
+		"128",
+		"256",
+	};
+
+	i32 quantums[] =
+	{
+		0,
+		32,
+		64,
+		128,
+		256,
+	};
+
+	i32 GetQuantumIdx(i32 value)
+	{
+		for(i32 i = 0; i < 5; ++i)
+		{
+			if(quantums[i] == value)
+				return i;
+		}
+		return 0;
+	}
+
+	const char* outputStageStrs[] =
+	{
+		"Hard Clip",
+		"Soft Clip",
+		"Limiter",
+	};
+
 	i32 GetBufferSizeIdx(i32 value)
 	{
 		for(i32 i = 0; i < 4; ++i)
@@ -78,6 +113,7 @@ namespace Gui
 
 		sampleRateIdx_ = GetSampleRateIdx(settings_.sampleRate_);
 		bufferSizeIdx_ = GetBufferSizeIdx(settings_.bufferSize_);
+		quantumIdx_ = GetQuantumIdx(settings_.quantum_);
 	
 	}
 
@@ -114,6 +150,19 @@ namespace Gui
 
 				Gui::Combo("Sample Rate:", &sampleRateIdx_, sampleRateStrs, 3);				
 				Gui::Combo("Buffer Size:", &bufferSizeIdx_, bufferSizeStrs, 4);
+				ImGui::Checkbox("Let device choose buffer size", &settings_.hostBufferUnspecified_);
+				Gui::Combo("Processing Quantum:", &quantumIdx_, quantumStrs, 5);
+				ImGui::Checkbox("Separate input/output clocks", &settings_.separateStreams_);
+
+				i32 outputStageIdx = (i32)settings_.outputStage_;
+				Gui::Combo("Output Stage:", &outputStageIdx, outputStageStrs, 3);
+				settings_.outputStage_ = (AudioOutputStage)outputStageIdx;
+				if(settings_.outputStage_ == AudioOutputStage::LIMITER)
+				{
+					Gui::SliderFloat("Limiter Ceiling:", &settings_.limiterCeiling_, 0.5f, 1.0f);
+					Gui::SliderFloat("Limiter Lookahead (ms):", &settings_.limiterLookaheadMs_, 0.1f, 10.0f);
+					Gui::SliderFloat("Limiter Release (ms):", &settings_.limiterReleaseMs_, 1.0f, 500.0f);
+				}
 			}
 
 			if(ImGui::Button("Start"))
@@ -122,6 +171,7 @@ namespace Gui
 				settings_.outputDevice_ = audioBackend_.GetOutputDeviceInfo(outputDeviceIdx_).uuid_;
 				settings_.sampleRate_ = sampleRates[sampleRateIdx_];
 				settings_.bufferSize_ = bufferSizes[bufferSizeIdx_];
+				settings_.quantum_ = quantums[quantumIdx_];
 				if(audioBackend_.StartDevice(settings_))
 				{
 					ImGui::End();
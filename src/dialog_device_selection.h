@@ -29,6 +29,7 @@ namespace Gui
 		i32 outputDeviceIdx_ = 0;
 		i32 sampleRateIdx_ = 0;
 		i32 bufferSizeIdx_ = 0;
+		i32 quantumIdx_ = 0;
 
 		AudioDeviceSettings settings_;
 	};
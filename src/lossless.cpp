@@ -0,0 +1,574 @@
+#include "lossless.h"
+#include "sound.h"
+#include "core/file.h"
+#include "core/misc.h"
+
+#include "ispc/lossless_ispc.h"
+
+#include <cstring>
+#include <utility>
+
+namespace Sound
+{
+	namespace Lossless
+	{
+		/// Channel encodings.
+		static const u32 TYPE_CONSTANT = 0;
+		static const u32 TYPE_VERBATIM = 1;
+		static const u32 TYPE_FIXED = 2;
+		static const u32 TYPE_FLOAT = 3;
+		static const i32 TYPE_BITS = 3;
+		static const i32 ORDER_BITS = 3;
+		/// 24 bit fixed point with 3 bits of headroom, so samples beyond +/-1.0 are exact too.
+		/// Small enough for residuals of the highest order predictor to fit in 32 bits.
+		static const i32 SAMPLE_BITS = 27;
+		static const i32 VERSION_1_SAMPLE_BITS = 24;
+		static const i32 RICE_PARAM_BITS = 5;
+		static const i32 MAX_RICE_PARAM = 30;
+		/// Unary quotients this long are followed by the raw value instead.
+		static const i32 RICE_ESCAPE = 24;
+		static const i32 MAX_PARTITIONS = BLOCK_FRAMES / PARTITION_SIZE;
+		/// Limits to reject corrupt headers with.
+		static const i32 MAX_BLOCK_FRAMES = 65536;
+
+		struct BlockHeader
+		{
+			u32 numBytes_ = 0;
+			u32 numFrames_ = 0;
+		};
+
+		/// Writes bits LSB first.
+		class BitWriter
+		{
+		public:
+			BitWriter(Core::Vector<u8>& out)
+				: out_(out)
+			{
+			}
+
+			void Write(u32 value, i32 numBits)
+			{
+				if(numBits < 32)
+					value &= (1u << numBits) - 1;
+				bits_ |= (u64)value << numBits_;
+				numBits_ += numBits;
+				while(numBits_ >= 8)
+				{
+					out_.push_back((u8)bits_);
+					bits_ >>= 8;
+					numBits_ -= 8;
+				}
+			}
+
+			void WriteSample(i32 value)
+			{
+				Write((u32)value, SAMPLE_BITS);
+			}
+
+			void WriteRice(u32 value, i32 param)
+			{
+				const u32 quotient = value >> param;
+				if(quotient < RICE_ESCAPE)
+				{
+					Write(1u << quotient, quotient + 1);
+					Write(value, param);
+				}
+				else
+				{
+					Write(1u << RICE_ESCAPE, RICE_ESCAPE + 1);
+					Write(value, 32);
+				}
+			}
+
+			/// Pad to a byte boundary.
+			void Flush()
+			{
+				if(numBits_ > 0)
+					Write(0, 8 - numBits_);
+			}
+
+		private:
+			Core::Vector<u8>& out_;
+			u64 bits_ = 0;
+			i32 numBits_ = 0;
+		};
+
+		/// Reads bits LSB first. Reads past the end return zeros.
+		class BitReader
+		{
+		public:
+			BitReader(const u8* data, i32 size, i32 sampleBits)
+				: data_(data)
+				, size_(size)
+				, sampleBits_(sampleBits)
+			{
+			}
+
+			u32 Read(i32 numBits)
+			{
+				if(numBits_ < numBits)
+					Refill();
+				const u32 value = numBits < 32 ? (u32)bits_ & ((1u << numBits) - 1) : (u32)bits_;
+				bits_ >>= numBits;
+				numBits_ -= numBits;
+				return value;
+			}
+
+			i32 ReadSample()
+			{
+				return (i32)(Read(sampleBits_) << (32 - sampleBits_)) >> (32 - sampleBits_);
+			}
+
+			u32 ReadRice(i32 param)
+			{
+				if(numBits_ <= RICE_ESCAPE)
+					Refill();
+				u32 quotient = 0;
+				while(quotient < RICE_ESCAPE && (bits_ & 1) == 0)
+				{
+					bits_ >>= 1;
+					++quotient;
+				}
+				bits_ >>= 1;
+				numBits_ -= quotient + 1;
+
+				if(quotient == RICE_ESCAPE)
+					return Read(32);
+				return (quotient << param) | Read(param);
+			}
+
+		private:
+			void Refill()
+			{
+				while(numBits_ <= 56)
+				{
+					const u64 byte = offset_ < size_ ? data_[offset_] : 0;
+					++offset_;
+					bits_ |= byte << numBits_;
+					numBits_ += 8;
+				}
+			}
+
+			const u8* data_ = nullptr;
+			i32 size_ = 0;
+			i32 sampleBits_ = 0;
+			i32 offset_ = 0;
+			u64 bits_ = 0;
+			i32 numBits_ = 0;
+		};
+
+		u32 ZigZag(i32 value)
+		{
+			return ((u32)value << 1) ^ (u32)(value >> 31);
+		}
+
+		i32 UnZigZag(u32 value)
+		{
+			return (i32)(value >> 1) ^ -(i32)(value & 1);
+		}
+
+		i32 Predict(const i32* samples, i32 idx, i32 order)
+		{
+			const i32* x = samples + idx;
+			switch(order)
+			{
+			case 1: return x[-1];
+			case 2: return 2 * x[-1] - x[-2];
+			case 3: return 3 * x[-1] - 3 * x[-2] + x[-3];
+			case 4: return 4 * x[-1] - 6 * x[-2] + 4 * x[-3] - x[-4];
+			default: return 0;
+			}
+		}
+
+		/// Bits used to rice code @a residuals with @a param.
+		i64 GetRiceBits(const u32* residuals, i32 numResiduals, i32 param)
+		{
+			i64 numBits = 0;
+			for(i32 idx = 0; idx < numResiduals; ++idx)
+			{
+				const u32 quotient = residuals[idx] >> param;
+				numBits += quotient < RICE_ESCAPE ? quotient + 1 + param : RICE_ESCAPE + 1 + 32;
+			}
+			return numBits;
+		}
+
+		/// Pick the cheapest rice parameter around the one estimated from the mean.
+		i32 GetRiceParam(const u32* residuals, i32 numResiduals, i64& outNumBits)
+		{
+			u64 sum = 0;
+			for(i32 idx = 0; idx < numResiduals; ++idx)
+				sum += residuals[idx];
+
+			i32 estimate = 0;
+			while(estimate < MAX_RICE_PARAM && ((u64)numResiduals << (estimate + 1)) <= sum)
+				++estimate;
+
+			i32 bestParam = estimate;
+			outNumBits = GetRiceBits(residuals, numResiduals, estimate);
+			for(i32 param = Core::Max(estimate - 1, 0); param <= Core::Min(estimate + 1, MAX_RICE_PARAM); ++param)
+			{
+				if(param == estimate)
+					continue;
+				const i64 numBits = GetRiceBits(residuals, numResiduals, param);
+				if(numBits < outNumBits)
+				{
+					outNumBits = numBits;
+					bestParam = param;
+				}
+			}
+			return bestParam;
+		}
+
+		Encoder::Encoder(Core::File& file, i32 numChannels, i32 sampleRate)
+			: file_(&file)
+		{
+			header_.numChannels_ = (u16)numChannels;
+			header_.sampleRate_ = (u32)sampleRate;
+			samples_.resize(numChannels * BLOCK_FRAMES);
+			floats_.resize(numChannels * BLOCK_FRAMES);
+			isExact_.resize(numChannels, 1);
+			residuals_.resize(BLOCK_FRAMES);
+			file_->Write(&header_, sizeof(header_));
+		}
+
+		Encoder::~Encoder()
+		{
+		}
+
+		void Encoder::Encode(const f32* const* channels, i32 numFrames)
+		{
+			for(i32 offset = 0; offset < numFrames; )
+			{
+				const i32 numCopy = Core::Min(numFrames - offset, BLOCK_FRAMES - numFrames_);
+				for(i32 ch = 0; ch < header_.numChannels_; ++ch)
+				{
+					const i32 blockOffset = ch * BLOCK_FRAMES + numFrames_;
+					if(!ispc::lossless_quantize(channels[ch] + offset, samples_.data() + blockOffset, numCopy))
+						isExact_[ch] = 0;
+					memcpy(floats_.data() + blockOffset, channels[ch] + offset, sizeof(f32) * numCopy);
+				}
+				numFrames_ += numCopy;
+				offset += numCopy;
+
+				if(numFrames_ == BLOCK_FRAMES)
+					EncodeBlock();
+			}
+		}
+
+		void Encoder::Finish()
+		{
+			if(numFrames_ > 0)
+				EncodeBlock();
+
+			header_.seekTableOffset_ = file_->Tell();
+			const u32 numBlocks = (u32)seekTable_.size();
+			file_->Write(&numBlocks, sizeof(numBlocks));
+			file_->Write(seekTable_.data(), sizeof(i64) * numBlocks);
+
+			file_->Seek(0);
+			file_->Write(&header_, sizeof(header_));
+		}
+
+		void Encoder::EncodeBlock()
+		{
+			blockData_.clear();
+			BitWriter writer(blockData_);
+			for(i32 ch = 0; ch < header_.numChannels_; ++ch)
+			{
+				if(isExact_[ch])
+				{
+					EncodeChannel(writer, samples_.data() + ch * BLOCK_FRAMES, numFrames_);
+				}
+				else
+				{
+					// Processed or out of range, keep the exact bits.
+					const u32* bits = reinterpret_cast<const u32*>(floats_.data() + ch * BLOCK_FRAMES);
+					writer.Write(TYPE_FLOAT, TYPE_BITS);
+					for(i32 idx = 0; idx < numFrames_; ++idx)
+						writer.Write(bits[idx], 32);
+				}
+				isExact_[ch] = 1;
+			}
+			writer.Flush();
+
+			seekTable_.push_back(file_->Tell());
+			BlockHeader blockHeader;
+			blockHeader.numBytes_ = (u32)blockData_.size();
+			blockHeader.numFrames_ = (u32)numFrames_;
+			file_->Write(&blockHeader, sizeof(blockHeader));
+			file_->Write(blockData_.data(), blockData_.size());
+
+			header_.numFrames_ += numFrames_;
+			numFrames_ = 0;
+		}
+
+		void Encoder::EncodeChannel(BitWriter& writer, const i32* samples, i32 numFrames)
+		{
+			// Silence & DC are common between takes.
+			bool isConstant = true;
+			for(i32 idx = 1; idx < numFrames && isConstant; ++idx)
+				isConstant = samples[idx] == samples[0];
+			if(isConstant)
+			{
+				writer.Write(TYPE_CONSTANT, TYPE_BITS);
+				writer.WriteSample(samples[0]);
+				return;
+			}
+
+			// Lowest total error is close enough to the cheapest to code.
+			i64 errors[MAX_FIXED_ORDER + 1] = {};
+			ispc::lossless_fixed_errors(samples, numFrames, errors);
+			i32 order = 0;
+			for(i32 idx = 1; idx <= MAX_FIXED_ORDER; ++idx)
+				if(errors[idx] < errors[order])
+					order = idx;
+			order = Core::Min(order, numFrames);
+
+			u32* residuals = reinterpret_cast<u32*>(residuals_.data());
+			for(i32 idx = order; idx < numFrames; ++idx)
+				residuals[idx] = ZigZag(samples[idx] - Predict(samples, idx, order));
+
+			const i32 numPartitions = (numFrames + PARTITION_SIZE - 1) / PARTITION_SIZE;
+			i32 params[MAX_PARTITIONS];
+			i64 numBits = ORDER_BITS + order * SAMPLE_BITS;
+			for(i32 partition = 0; partition < numPartitions; ++partition)
+			{
+				const i32 begin = Core::Max(partition * PARTITION_SIZE, order);
+				const i32 end = Core::Min((partition + 1) * PARTITION_SIZE, numFrames);
+				i64 partitionBits = 0;
+				params[partition] = GetRiceParam(residuals + begin, end - begin, partitionBits);
+				numBits += RICE_PARAM_BITS + partitionBits;
+			}
+
+			// Noise doesn't predict, store as is.
+			if(numBits >= (i64)numFrames * SAMPLE_BITS)
+			{
+				writer.Write(TYPE_VERBATIM, TYPE_BITS);
+				for(i32 idx = 0; idx < numFrames; ++idx)
+					writer.WriteSample(samples[idx]);
+				return;
+			}
+
+			writer.Write(TYPE_FIXED, TYPE_BITS);
+			writer.Write(order, ORDER_BITS);
+			for(i32 idx = 0; idx < order; ++idx)
+				writer.WriteSample(samples[idx]);
+			for(i32 partition = 0; partition < numPartitions; ++partition)
+			{
+				const i32 begin = Core::Max(partition * PARTITION_SIZE, order);
+				const i32 end = Core::Min((partition + 1) * PARTITION_SIZE, numFrames);
+				writer.Write(params[partition], RICE_PARAM_BITS);
+				for(i32 idx = begin; idx < end; ++idx)
+					writer.WriteRice(residuals[idx], params[partition]);
+			}
+		}
+
+		bool Decoder::Open(Core::File& file)
+		{
+			Close();
+
+			Header header;
+			if(file.Read(&header, sizeof(header)) != sizeof(header))
+				return false;
+			if(header.id_ != TAG || header.version_ < 1 || header.version_ > VERSION || header.numChannels_ == 0 ||
+				header.blockFrames_ == 0 || header.blockFrames_ > MAX_BLOCK_FRAMES)
+				return false;
+
+			file_ = &file;
+			numChannels_ = header.numChannels_;
+			sampleRate_ = header.sampleRate_;
+			blockFrames_ = header.blockFrames_;
+			sampleBits_ = header.version_ == 1 ? VERSION_1_SAMPLE_BITS : SAMPLE_BITS;
+
+			const i64 fileSize = file.Size();
+			u32 numBlocks = 0;
+			if(header.seekTableOffset_ > 0)
+			{
+				file.Seek(header.seekTableOffset_);
+				if(file.Read(&numBlocks, sizeof(numBlocks)) != sizeof(numBlocks) ||
+					header.seekTableOffset_ + (i64)sizeof(numBlocks) + (i64)sizeof(i64) * numBlocks > fileSize)
+					numBlocks = 0;
+			}
+
+			if(numBlocks > 0)
+			{
+				seekTable_.resize(numBlocks);
+				file.Read(seekTable_.data(), sizeof(i64) * numBlocks);
+				numFrames_ = header.numFrames_;
+			}
+			else
+			{
+				// Stream wasn't finished, walk the blocks that made it to disk.
+				i64 offset = sizeof(header);
+				BlockHeader blockHeader;
+				file.Seek(offset);
+				while(file.Read(&blockHeader, sizeof(blockHeader)) == sizeof(blockHeader))
+				{
+					const i64 blockEnd = offset + sizeof(blockHeader) + blockHeader.numBytes_;
+					if(blockEnd > fileSize || blockHeader.numFrames_ > (u32)blockFrames_)
+						break;
+					seekTable_.push_back(offset);
+					numFrames_ += blockHeader.numFrames_;
+					offset = blockEnd;
+					file.Seek(offset);
+				}
+			}
+
+			samples_.resize(numChannels_ * blockFrames_);
+			isFloat_.resize(numChannels_);
+			return true;
+		}
+
+		void Decoder::Close()
+		{
+			file_ = nullptr;
+			numChannels_ = 0;
+			sampleRate_ = 0;
+			numFrames_ = 0;
+			seekTable_.clear();
+			block_ = -1;
+			numDecoded_ = 0;
+			position_ = 0;
+		}
+
+		i32 Decoder::Read(f32* data, i32 numFrames)
+		{
+			i32 numRead = 0;
+			while(numRead < numFrames && position_ < numFrames_)
+			{
+				const i32 block = (i32)(position_ / blockFrames_);
+				if(block != block_ && !DecodeBlock(block))
+					break;
+
+				const i32 blockOffset = (i32)(position_ - (i64)block * blockFrames_);
+				const i32 num = Core::Min(numFrames - numRead, numDecoded_ - blockOffset);
+				if(num <= 0)
+					break;
+
+				const f32 scale = 1.0f / 8388608.0f;
+				for(i32 idx = 0; idx < num; ++idx)
+				{
+					for(i32 ch = 0; ch < numChannels_; ++ch)
+					{
+						const i32 sample = samples_[ch * blockFrames_ + blockOffset + idx];
+						if(isFloat_[ch])
+							memcpy(data++, &sample, sizeof(f32));
+						else
+							*data++ = (f32)sample * scale;
+					}
+				}
+
+				numRead += num;
+				position_ += num;
+			}
+			return numRead;
+		}
+
+		bool Decoder::Seek(i64 frame)
+		{
+			if(!file_ || frame < 0 || frame > numFrames_)
+				return false;
+			position_ = frame;
+			return true;
+		}
+
+		bool Decoder::DecodeBlock(i32 block)
+		{
+			block_ = -1;
+			numDecoded_ = 0;
+			if(block >= seekTable_.size())
+				return false;
+
+			BlockHeader blockHeader;
+			file_->Seek(seekTable_[block]);
+			if(file_->Read(&blockHeader, sizeof(blockHeader)) != sizeof(blockHeader))
+				return false;
+
+			// Worst case is every residual escaped.
+			const i64 maxBytes = (i64)numChannels_ * (blockFrames_ * (RICE_ESCAPE + 1 + 32) + 64) / 8;
+			const i32 numFrames = (i32)blockHeader.numFrames_;
+			if(numFrames > blockFrames_ || blockHeader.numBytes_ > maxBytes)
+				return false;
+
+			blockData_.resize(blockHeader.numBytes_);
+			if(file_->Read(blockData_.data(), blockHeader.numBytes_) != blockHeader.numBytes_)
+				return false;
+
+			BitReader reader(blockData_.data(), blockData_.size(), sampleBits_);
+			for(i32 ch = 0; ch < numChannels_; ++ch)
+			{
+				i32* samples = samples_.data() + ch * blockFrames_;
+				const u32 type = reader.Read(TYPE_BITS);
+				isFloat_[ch] = type == TYPE_FLOAT;
+				if(type == TYPE_FLOAT)
+				{
+					for(i32 idx = 0; idx < numFrames; ++idx)
+						samples[idx] = (i32)reader.Read(32);
+				}
+				else if(type == TYPE_CONSTANT)
+				{
+					const i32 value = reader.ReadSample();
+					for(i32 idx = 0; idx < numFrames; ++idx)
+						samples[idx] = value;
+				}
+				else if(type == TYPE_VERBATIM)
+				{
+					for(i32 idx = 0; idx < numFrames; ++idx)
+						samples[idx] = reader.ReadSample();
+				}
+				else if(type == TYPE_FIXED)
+				{
+					const i32 order = reader.Read(ORDER_BITS);
+					if(order > MAX_FIXED_ORDER || order > numFrames)
+						return false;
+					for(i32 idx = 0; idx < order; ++idx)
+						samples[idx] = reader.ReadSample();
+
+					const i32 numPartitions = (numFrames + PARTITION_SIZE - 1) / PARTITION_SIZE;
+					for(i32 partition = 0; partition < numPartitions; ++partition)
+					{
+						const i32 begin = Core::Max(partition * PARTITION_SIZE, order);
+						const i32 end = Core::Min((partition + 1) * PARTITION_SIZE, numFrames);
+						const i32 param = reader.Read(RICE_PARAM_BITS);
+						for(i32 idx = begin; idx < end; ++idx)
+							samples[idx] = UnZigZag(reader.ReadRice(param)) + Predict(samples, idx, order);
+					}
+				}
+				else
+				{
+					return false;
+				}
+			}
+
+			block_ = block;
+			numDecoded_ = numFrames;
+			return true;
+		}
+
+		Data Load(Core::File& file)
+		{
+			Data data;
+			Decoder decoder;
+			if(decoder.Open(file))
+			{
+				data.numChannels_ = decoder.numChannels_;
+				data.sampleRate_ = decoder.sampleRate_;
+				data.format_ = Format::F32;
+				data.numBytes_ = sizeof(f32) * decoder.numFrames_ * data.numChannels_;
+				data.rawData_ = new u8[data.numBytes_];
+
+				// Read a block at a time, as reads are counted in 32 bits.
+				f32* samples = reinterpret_cast<f32*>(data.rawData_);
+				while(data.numSamples_ < decoder.numFrames_)
+				{
+					const i32 numRead = decoder.Read(samples + data.numSamples_ * data.numChannels_, BLOCK_FRAMES);
+					if(numRead == 0)
+						break;
+					data.numSamples_ += numRead;
+				}
+				data.numBytes_ = sizeof(f32) * data.numSamples_ * data.numChannels_;
+			}
+			return std::move(data);
+		}
+	} // namespace Lossless
+} // namespace Sound
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "core/types.h"
+#include "core/vector.h"
+
+namespace Core
+{
+	class File;
+} // namespace Core
+
+namespace Sound
+{
+	struct Data;
+
+	namespace Lossless
+	{
+		class BitWriter;
+
+		static const u32 TAG = 'RPLM';
+		/// Version 1 stored 24 bit samples, clipped to +/-1.0, so wasn't exact for all f32 input.
+		static const u16 VERSION = 2;
+		/// Frames per block. All blocks but the last are full.
+		static const i32 BLOCK_FRAMES = 4096;
+		/// Residuals per rice parameter.
+		static const i32 PARTITION_SIZE = 256;
+		static const i32 MAX_FIXED_ORDER = 4;
+
+		/**
+		 * File header. Followed by blocks, then a seek table of block offsets.
+		 * Each block is a u32 payload size & u32 frame count, then a bitstream holding each channel in turn.
+		 */
+		struct Header
+		{
+			u32 id_ = TAG;
+			u16 version_ = VERSION;
+			u16 numChannels_ = 0;
+			u32 sampleRate_ = 0;
+			u32 blockFrames_ = BLOCK_FRAMES;
+			/// Total frames & seek table offset. Written on Finish, 0 if the stream wasn't finished.
+			i64 numFrames_ = 0;
+			i64 seekTableOffset_ = 0;
+		};
+
+		/**
+		 * Encodes non-interleaved f32 samples exactly.
+		 * Channels of a block which are all 24 bit fixed point, as from an integer source, are predicted
+		 * with the best fixed polynomial predictor, and the residuals rice coded with a parameter per partition.
+		 * Anything else is stored as raw f32 bits.
+		 * Not thread safe, but only touches its own file so encoders can run on separate jobs.
+		 */
+		class Encoder
+		{
+		public:
+			Encoder(Core::File& file, i32 numChannels, i32 sampleRate);
+			~Encoder();
+			Encoder(const Encoder&) = delete;
+			Encoder& operator=(const Encoder&) = delete;
+
+			/**
+			 * Encode frames. Full blocks are written to file, the rest are held until more arrive.
+			 */
+			void Encode(const f32* const* channels, i32 numFrames);
+
+			/**
+			 * Write remaining frames, the seek table, and patch the header.
+			 */
+			void Finish();
+
+			i64 GetNumFrames() const { return header_.numFrames_ + numFrames_; }
+
+		private:
+			void EncodeBlock();
+			void EncodeChannel(BitWriter& writer, const i32* samples, i32 numFrames);
+
+			Core::File* file_ = nullptr;
+			Header header_;
+			/// Quantised samples of the pending block, BLOCK_FRAMES per channel.
+			Core::Vector<i32> samples_;
+			/// Original samples of the pending block, for channels which don't quantise exactly.
+			Core::Vector<f32> floats_;
+			/// Per channel, all samples so far in the pending block quantise exactly.
+			Core::Vector<u8> isExact_;
+			i32 numFrames_ = 0;
+			Core::Vector<i32> residuals_;
+			Core::Vector<u8> blockData_;
+			Core::Vector<i64> seekTable_;
+		};
+
+		/**
+		 * Incremental decoder. Only the current block is held in memory.
+		 */
+		class Decoder
+		{
+		public:
+			Decoder() = default;
+			~Decoder() { Close(); }
+			Decoder(const Decoder&) = delete;
+			Decoder& operator=(const Decoder&) = delete;
+
+			bool Open(Core::File& file);
+			void Close();
+
+			/**
+			 * Read up to @a numFrames interleaved frames.
+			 * @return Number of frames read.
+			 */
+			i32 Read(f32* data, i32 numFrames);
+
+			bool Seek(i64 frame);
+
+			operator bool() const { return file_ != nullptr; }
+
+			i32 numChannels_ = 0;
+			i32 sampleRate_ = 0;
+			i64 numFrames_ = 0;
+
+		private:
+			bool DecodeBlock(i32 block);
+
+			Core::File* file_ = nullptr;
+			i32 blockFrames_ = 0;
+			i32 sampleBits_ = 0;
+			/// Offset of each block in file.
+			Core::Vector<i64> seekTable_;
+			Core::Vector<u8> blockData_;
+			/// Decoded samples of the current block, non-interleaved. Raw f32 bits for channels in @a isFloat_.
+			Core::Vector<i32> samples_;
+			Core::Vector<u8> isFloat_;
+			i32 block_ = -1;
+			i32 numDecoded_ = 0;
+			/// Frame at the read position.
+			i64 position_ = 0;
+		};
+
+		/**
+		 * Load a whole file as interleaved f32.
+		 */
+		Data Load(Core::File& file);
+	} // namespace Lossless
+} // namespace Sound
@@ -0,0 +1,342 @@
+#include "peak_pyramid.h"
+#include "sample_cache.h"
+#include "sound.h"
+#include "core/array.h"
+#include "core/file.h"
+#include "core/misc.h"
+
+#include "ispc/peaks_ispc.h"
+
+#include <cmath>
+#include <cstdio>
+
+namespace Sound
+{
+	namespace
+	{
+		static const u32 TAG = 'SKPM';
+		static const u16 VERSION = 1;
+		/// Frames read at a time when building from a file.
+		static const i32 BUILD_FRAMES = 4096;
+
+		struct Header
+		{
+			u32 id_ = TAG;
+			u16 version_ = VERSION;
+			u16 numChannels_ = 0;
+			u32 sampleRate_ = 0;
+			u32 baseFrames_ = PeakPyramid::BASE_FRAMES;
+			u32 levelFactor_ = PeakPyramid::LEVEL_FACTOR;
+			u32 numLevels_ = 0;
+			i64 numFrames_ = 0;
+			/// Size of the sound file the peaks were built from.
+			i64 sourceSize_ = 0;
+		};
+
+		void Combine(Peak& peak, const Peak& other)
+		{
+			peak.min_ = Core::Min(peak.min_, other.min_);
+			peak.max_ = Core::Max(peak.max_, other.max_);
+			peak.rms_ += other.rms_ * other.rms_;
+		}
+	}
+
+	PeakPyramid::PackedPeak PeakPyramid::Pack(const Peak& peak)
+	{
+		PackedPeak packed;
+		packed.min_ = (i16)std::floor(Core::Clamp(peak.min_, -1.0f, 1.0f) * 32767.0f);
+		packed.max_ = (i16)std::ceil(Core::Clamp(peak.max_, -1.0f, 1.0f) * 32767.0f);
+		packed.rms_ = (u16)std::round(Core::Clamp(peak.rms_, 0.0f, 1.0f) * 65535.0f);
+		return packed;
+	}
+
+	Peak PeakPyramid::Unpack(const PackedPeak& packed)
+	{
+		Peak peak;
+		peak.min_ = packed.min_ * (1.0f / 32767.0f);
+		peak.max_ = packed.max_ * (1.0f / 32767.0f);
+		peak.rms_ = packed.rms_ * (1.0f / 65535.0f);
+		return peak;
+	}
+
+	PeakPyramid::PeakPyramid(i32 numChannels, i32 sampleRate)
+	{
+		Reset(numChannels, sampleRate);
+	}
+
+	PeakPyramid::~PeakPyramid()
+	{
+	}
+
+	void PeakPyramid::Reset(i32 numChannels, i32 sampleRate)
+	{
+		numChannels_ = numChannels;
+		sampleRate_ = sampleRate;
+		numFrames_ = 0;
+		levels_.clear();
+		levels_.resize(1);
+		partial_.clear();
+		partial_.resize(numChannels);
+		numPartialFrames_ = 0;
+	}
+
+	void PeakPyramid::Push(const f32* const* channels, i32 numFrames)
+	{
+		for(i32 offset = 0; offset < numFrames; )
+		{
+			const i32 num = Core::Min(numFrames - offset, BASE_FRAMES - numPartialFrames_);
+			for(i32 ch = 0; ch < numChannels_; ++ch)
+			{
+				f32 reduced[3];
+				ispc::peaks_reduce(channels[ch] + offset, num, reduced);
+
+				Peak& peak = partial_[ch];
+				if(numPartialFrames_ == 0)
+				{
+					peak.min_ = reduced[0];
+					peak.max_ = reduced[1];
+					peak.rms_ = reduced[2];
+				}
+				else
+				{
+					peak.min_ = Core::Min(peak.min_, reduced[0]);
+					peak.max_ = Core::Max(peak.max_, reduced[1]);
+					peak.rms_ += reduced[2];
+				}
+			}
+			numPartialFrames_ += num;
+			numFrames_ += num;
+			offset += num;
+
+			if(numPartialFrames_ == BASE_FRAMES)
+				PushPartial();
+		}
+	}
+
+	void PeakPyramid::PushPartial()
+	{
+		for(i32 ch = 0; ch < numChannels_; ++ch)
+		{
+			Peak peak = partial_[ch];
+			peak.rms_ = std::sqrt(peak.rms_ / numPartialFrames_);
+			levels_[0].push_back(Pack(peak));
+		}
+		numPartialFrames_ = 0;
+	}
+
+	void PeakPyramid::Finish()
+	{
+		if(numChannels_ == 0)
+			return;
+		if(numPartialFrames_ > 0)
+			PushPartial();
+
+		// Coarser levels until a single peak covers the whole sound.
+		levels_.resize(1);
+		while(levels_.back().size() > numChannels_)
+		{
+			levels_.resize(levels_.size() + 1);
+			const auto& in = levels_[levels_.size() - 2];
+			auto& out = levels_.back();
+			const i32 numIn = in.size() / numChannels_;
+			const i32 numOut = (numIn + LEVEL_FACTOR - 1) / LEVEL_FACTOR;
+			out.resize(numOut * numChannels_);
+			for(i32 idx = 0; idx < numOut; ++idx)
+			{
+				const i32 begin = idx * LEVEL_FACTOR;
+				const i32 end = Core::Min(begin + LEVEL_FACTOR, numIn);
+				for(i32 ch = 0; ch < numChannels_; ++ch)
+				{
+					Peak peak = Unpack(in[begin * numChannels_ + ch]);
+					peak.rms_ *= peak.rms_;
+					for(i32 inIdx = begin + 1; inIdx < end; ++inIdx)
+						Combine(peak, Unpack(in[inIdx * numChannels_ + ch]));
+					peak.rms_ = std::sqrt(peak.rms_ / (end - begin));
+					out[idx * numChannels_ + ch] = Pack(peak);
+				}
+			}
+		}
+	}
+
+	void PeakPyramid::GetPeaks(i32 channel, i64 beginFrame, i64 endFrame, Peak* outPeaks, i32 numPeaks) const
+	{
+		if(channel < 0 || channel >= numChannels_ || endFrame <= beginFrame || levels_[0].size() == 0)
+		{
+			for(i32 idx = 0; idx < numPeaks; ++idx)
+				outPeaks[idx] = Peak();
+			return;
+		}
+
+		// Coarsest level with at least one peak per output peak.
+		const f64 framesPerPeak = (f64)(endFrame - beginFrame) / (f64)numPeaks;
+		i32 level = 0;
+		i64 levelFrames = BASE_FRAMES;
+		while(level + 1 < levels_.size() && levelFrames * LEVEL_FACTOR <= framesPerPeak)
+		{
+			++level;
+			levelFrames *= LEVEL_FACTOR;
+		}
+
+		const auto& peaks = levels_[level];
+		const i64 numLevelPeaks = peaks.size() / numChannels_;
+		for(i32 idx = 0; idx < numPeaks; ++idx)
+		{
+			const i64 begin = beginFrame + (i64)(idx * framesPerPeak);
+			const i64 end = beginFrame + (i64)((idx + 1) * framesPerPeak);
+			const i64 first = begin / levelFrames;
+			const i64 last = Core::Min(Core::Max(first + 1, (end + levelFrames - 1) / levelFrames), numLevelPeaks);
+			if(first >= numLevelPeaks)
+			{
+				outPeaks[idx] = Peak();
+				continue;
+			}
+
+			Peak peak = Unpack(peaks[first * numChannels_ + channel]);
+			peak.rms_ *= peak.rms_;
+			for(i64 peakIdx = first + 1; peakIdx < last; ++peakIdx)
+				Combine(peak, Unpack(peaks[peakIdx * numChannels_ + channel]));
+			peak.rms_ = std::sqrt(peak.rms_ / (f32)(last - first));
+			outPeaks[idx] = peak;
+		}
+	}
+
+	bool PeakPyramid::Save(Core::File& file, i64 sourceSize) const
+	{
+		Header header;
+		header.numChannels_ = (u16)numChannels_;
+		header.sampleRate_ = (u32)sampleRate_;
+		header.numLevels_ = (u32)levels_.size();
+		header.numFrames_ = numFrames_;
+		header.sourceSize_ = sourceSize;
+		if(file.Write(&header, sizeof(header)) != sizeof(header))
+			return false;
+
+		for(const auto& level : levels_)
+		{
+			const i64 numPeaks = level.size();
+			file.Write(&numPeaks, sizeof(numPeaks));
+		}
+		for(const auto& level : levels_)
+		{
+			const i64 numBytes = sizeof(PackedPeak) * level.size();
+			if(file.Write(level.data(), numBytes) != numBytes)
+				return false;
+		}
+		return true;
+	}
+
+	bool PeakPyramid::Load(Core::File& file, i64 sourceSize)
+	{
+		Header header;
+		if(file.Read(&header, sizeof(header)) != sizeof(header))
+			return false;
+		if(header.id_ != TAG || header.version_ != VERSION || header.sourceSize_ != sourceSize ||
+			header.baseFrames_ != BASE_FRAMES || header.levelFactor_ != LEVEL_FACTOR || header.numChannels_ == 0)
+			return false;
+
+		// Check level sizes against the file before allocating anything.
+		Core::Vector<i64> numPeaks;
+		numPeaks.resize(header.numLevels_);
+		if(file.Read(numPeaks.data(), sizeof(i64) * header.numLevels_) != (i64)sizeof(i64) * header.numLevels_)
+			return false;
+		i64 totalBytes = 0;
+		for(i64 num : numPeaks)
+			totalBytes += num * sizeof(PackedPeak);
+		if(totalBytes != file.Size() - file.Tell())
+			return false;
+
+		Reset(header.numChannels_, header.sampleRate_);
+		numFrames_ = header.numFrames_;
+		levels_.resize(header.numLevels_);
+		for(i32 level = 0; level < levels_.size(); ++level)
+		{
+			levels_[level].resize((i32)numPeaks[level]);
+			file.Read(levels_[level].data(), sizeof(PackedPeak) * numPeaks[level]);
+		}
+		return true;
+	}
+
+	bool PeakPyramid::LoadOrBuild(const char* fileName, SampleCache* cache)
+	{
+		i64 sourceSize = 0;
+		{
+			Core::File sourceFile(fileName, Core::FileFlags::READ);
+			if(!sourceFile)
+				return false;
+			sourceSize = sourceFile.Size();
+		}
+
+		Core::Array<char, Core::MAX_PATH_LENGTH> sidecarName;
+		GetSidecarName(fileName, sidecarName.data(), sidecarName.size());
+		if(Core::FileExists(sidecarName.data()))
+		{
+			Core::File sidecarFile(sidecarName.data(), Core::FileFlags::READ);
+			if(sidecarFile && Load(sidecarFile, sourceSize))
+				return true;
+		}
+
+		InputStream stream(fileName);
+		if(!stream)
+			return false;
+
+		const i32 numChannels = stream.GetNumChannels();
+		Reset(numChannels, stream.GetSampleRate());
+
+		// Share the decoded copy with playback when it fits, rather than decoding the file twice.
+		CachedData cachedData;
+		if(cache && (i64)sizeof(f32) * stream.GetNumFrames() * numChannels <= cache->GetBudget())
+			cachedData = cache->Get(fileName);
+		if(cachedData && cachedData.GetData().numChannels_ != numChannels)
+			cachedData = CachedData();
+
+		Core::Vector<f32> interleaved;
+		Core::Vector<f32> deinterleaved;
+		Core::Vector<f32*> channels;
+		interleaved.resize(BUILD_FRAMES * numChannels);
+		deinterleaved.resize(BUILD_FRAMES * numChannels);
+		channels.resize(numChannels);
+		for(i32 ch = 0; ch < numChannels; ++ch)
+			channels[ch] = deinterleaved.data() + ch * BUILD_FRAMES;
+
+		if(cachedData)
+		{
+			const f32* samples = cachedData.GetSamples();
+			const i64 numFrames = cachedData.GetData().numSamples_;
+			for(i64 frame = 0; frame < numFrames; frame += BUILD_FRAMES)
+			{
+				const i32 numRead = (i32)Core::Min((i64)BUILD_FRAMES, numFrames - frame);
+				Deinterleave(samples + frame * numChannels, numChannels, numRead, channels.data());
+				Push(channels.data(), numRead);
+			}
+		}
+		else
+		{
+			i32 numRead = 0;
+			while((numRead = stream.Read(interleaved.data(), BUILD_FRAMES)) > 0)
+			{
+				Deinterleave(interleaved.data(), numChannels, numRead, channels.data());
+				Push(channels.data(), numRead);
+			}
+		}
+		Finish();
+
+		SaveSidecar(fileName, sourceSize);
+		return true;
+	}
+
+	bool PeakPyramid::SaveSidecar(const char* fileName, i64 sourceSize) const
+	{
+		Core::Array<char, Core::MAX_PATH_LENGTH> sidecarName;
+		GetSidecarName(fileName, sidecarName.data(), sidecarName.size());
+		if(Core::FileExists(sidecarName.data()))
+			Core::FileRemove(sidecarName.data());
+
+		Core::File sidecarFile(sidecarName.data(), Core::FileFlags::CREATE | Core::FileFlags::WRITE);
+		return sidecarFile && Save(sidecarFile, sourceSize);
+	}
+
+	void PeakPyramid::GetSidecarName(const char* fileName, char* outFileName, i32 maxLength)
+	{
+		sprintf_s(outFileName, maxLength, "%s.peaks", fileName);
+	}
+} // namespace Sound
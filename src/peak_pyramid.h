@@ -0,0 +1,103 @@
+#pragma once
+
+#include "core/types.h"
+#include "core/vector.h"
+
+namespace Core
+{
+	class File;
+} // namespace Core
+
+namespace Sound
+{
+	class SampleCache;
+
+	struct Peak
+	{
+		f32 min_ = 0.0f;
+		f32 max_ = 0.0f;
+		f32 rms_ = 0.0f;
+	};
+
+	/**
+	 * Multi-resolution min/max/RMS summary of a sound, for drawing & scrubbing long takes.
+	 * The finest level summarises BASE_FRAMES frames per peak, and each coarser level LEVEL_FACTOR
+	 * peaks of the one below, so any zoom level reads a bounded number of peaks.
+	 * Stored alongside the sound in a sidecar file.
+	 */
+	class PeakPyramid
+	{
+	public:
+		static const i32 BASE_FRAMES = 512;
+		static const i32 LEVEL_FACTOR = 4;
+
+		PeakPyramid(i32 numChannels = 0, i32 sampleRate = 0);
+		~PeakPyramid();
+		PeakPyramid(const PeakPyramid&) = delete;
+		PeakPyramid& operator=(const PeakPyramid&) = delete;
+
+		/**
+		 * Add non-interleaved frames. Only the finest level is built as frames arrive.
+		 */
+		void Push(const f32* const* channels, i32 numFrames);
+
+		/**
+		 * Complete the last partial peak, and build coarser levels.
+		 */
+		void Finish();
+
+		/**
+		 * Get @a numPeaks evenly spaced peaks covering frames [@a beginFrame, @a endFrame).
+		 * Reads from the coarsest level with enough detail, so cost only depends on @a numPeaks.
+		 */
+		void GetPeaks(i32 channel, i64 beginFrame, i64 endFrame, Peak* outPeaks, i32 numPeaks) const;
+
+		/**
+		 * Save & load sidecar. @a sourceSize is the size of the sound file, used to detect stale sidecars.
+		 */
+		bool Save(Core::File& file, i64 sourceSize) const;
+		bool Load(Core::File& file, i64 sourceSize);
+
+		/**
+		 * Load the sidecar for @a fileName, or build it by streaming the sound & save it if missing or stale.
+		 * When @a cache is given and the sound fits its budget, it is built from the shared decoded copy instead.
+		 */
+		bool LoadOrBuild(const char* fileName, SampleCache* cache = nullptr);
+
+		/**
+		 * Save the sidecar for @a fileName, once the sound has been completely written.
+		 */
+		bool SaveSidecar(const char* fileName, i64 sourceSize) const;
+
+		static void GetSidecarName(const char* fileName, char* outFileName, i32 maxLength);
+
+		i32 GetNumChannels() const { return numChannels_; }
+		i32 GetSampleRate() const { return sampleRate_; }
+		i64 GetNumFrames() const { return numFrames_; }
+		i32 GetNumLevels() const { return levels_.size(); }
+
+	private:
+		/// Peaks are stored at 16 bit to keep long multitrack takes small.
+		struct PackedPeak
+		{
+			i16 min_ = 0;
+			i16 max_ = 0;
+			u16 rms_ = 0;
+		};
+
+		static PackedPeak Pack(const Peak& peak);
+		static Peak Unpack(const PackedPeak& peak);
+
+		void Reset(i32 numChannels, i32 sampleRate);
+		void PushPartial();
+
+		i32 numChannels_ = 0;
+		i32 sampleRate_ = 0;
+		i64 numFrames_ = 0;
+		/// Peaks of each level, interleaved by channel.
+		Core::Vector<Core::Vector<PackedPeak>> levels_;
+		/// Finest level peak being accumulated, per channel, with sum of squares in rms_.
+		Core::Vector<Peak> partial_;
+		i32 numPartialFrames_ = 0;
+	};
+} // namespace Sound
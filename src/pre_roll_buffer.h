@@ -0,0 +1,94 @@
+#pragma once
+
+#include "core/concurrency.h"
+#include "core/misc.h"
+#include "core/vector.h"
+
+#include <cstring>
+
+/**
+ * Circular buffer of the most recent non-interleaved frames, written continuously by the audio thread
+ * so triggered recordings can include what came just before the trigger.
+ * Rather than being copied out, the whole buffer is handed to the consumer & released once it has been
+ * read, so the writer needs a spare to carry on with in the meantime.
+ */
+class PreRollBuffer
+{
+public:
+	PreRollBuffer() = default;
+	PreRollBuffer(const PreRollBuffer&) = delete;
+	PreRollBuffer& operator=(const PreRollBuffer&) = delete;
+
+	/**
+	 * Resize and clear buffer.
+	 * @pre Not in use.
+	 */
+	void Resize(i32 numChannels, i32 maxFrames)
+	{
+		numChannels_ = numChannels;
+		maxFrames_ = maxFrames;
+		data_.clear();
+		data_.resize(numChannels * maxFrames);
+		Reset();
+	}
+
+	/**
+	 * Clear buffer.
+	 * @pre Not in use.
+	 */
+	void Reset()
+	{
+		writePos_ = 0;
+		numFrames_ = 0;
+	}
+
+	/**
+	 * Writer: add frames, overwriting the oldest once full.
+	 */
+	void Write(const f32* const* channels, i32 numFrames)
+	{
+		if(maxFrames_ == 0)
+			return;
+
+		// Only the most recent maxFrames_ can be kept.
+		const i32 skip = Core::Max(numFrames - maxFrames_, 0);
+		for(i32 offset = skip; offset < numFrames; )
+		{
+			const i32 num = Core::Min(numFrames - offset, maxFrames_ - writePos_);
+			for(i32 ch = 0; ch < numChannels_; ++ch)
+				memcpy(data_.data() + ch * maxFrames_ + writePos_, channels[ch] + offset, sizeof(f32) * num);
+			writePos_ = (writePos_ + num) % maxFrames_;
+			offset += num;
+		}
+		numFrames_ = Core::Min(numFrames_ + numFrames - skip, maxFrames_);
+	}
+
+	/**
+	 * Reader: get contiguous frames of @a channel, starting @a frame frames after the oldest.
+	 * @param inOutNumFrames Frames wanted, clamped to those contiguous in memory.
+	 */
+	const f32* GetFrames(i32 channel, i32 frame, i32& inOutNumFrames) const
+	{
+		const i32 begin = (writePos_ - numFrames_ + frame + maxFrames_) % maxFrames_;
+		inOutNumFrames = Core::Min(inOutNumFrames, Core::Min(numFrames_ - frame, maxFrames_ - begin));
+		return data_.data() + channel * maxFrames_ + begin;
+	}
+
+	/// Set while handed to a reader.
+	bool IsInUse() const { return inUse_ != 0; }
+	void Acquire() { Core::AtomicExchg(&inUse_, 1); }
+	void Release() { Core::AtomicExchg(&inUse_, 0); }
+
+	i32 GetNumChannels() const { return numChannels_; }
+	i32 GetMaxFrames() const { return maxFrames_; }
+	i32 GetNumFrames() const { return numFrames_; }
+
+private:
+	/// Non-interleaved, maxFrames_ per channel.
+	Core::Vector<f32> data_;
+	i32 numChannels_ = 0;
+	i32 maxFrames_ = 0;
+	i32 writePos_ = 0;
+	i32 numFrames_ = 0;
+	volatile i32 inUse_ = 0;
+};
@@ -0,0 +1,323 @@
+#include "recording_catalog.h"
+#include "peak_pyramid.h"
+#include "sound.h"
+#include "core/array.h"
+#include "core/file.h"
+#include "core/misc.h"
+#include "job/manager.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+	static const u32 TAG = 'XDIR';
+	static const u32 VERSION = 1;
+	/// Recordings are scanned on this many jobs at startup.
+	static const i32 SCAN_JOBS = 32;
+	static const char* RECORDING_PREFIX = "audio_out_";
+
+	struct IndexHeader
+	{
+		u32 id_ = TAG;
+		u32 version_ = VERSION;
+		u32 entrySize_ = sizeof(RecordingEntry);
+		u32 reserved_ = 0;
+	};
+
+	bool IsRecording(const char* fileName)
+	{
+		if(strncmp(fileName, RECORDING_PREFIX, strlen(RECORDING_PREFIX)) != 0)
+			return false;
+		const char* extension = strrchr(fileName, '.');
+		return extension && (strcmp(extension, ".wav") == 0 || strcmp(extension, ".lpr") == 0) &&
+			strlen(fileName) < RecordingEntry::FILE_NAME_LENGTH;
+	}
+
+	/// Recordings in the working directory, with only the name set.
+	void FindRecordings(Core::Vector<RecordingEntry>& outEntries)
+	{
+		auto addEntry = [&outEntries](const char* fileName)
+		{
+			if(IsRecording(fileName))
+			{
+				RecordingEntry entry;
+				strcpy_s(entry.fileName_, sizeof(entry.fileName_), fileName);
+				outEntries.push_back(entry);
+			}
+		};
+
+#if defined(_WIN32)
+		WIN32_FIND_DATAA findData;
+		HANDLE handle = ::FindFirstFileA("audio_out_*", &findData);
+		if(handle != INVALID_HANDLE_VALUE)
+		{
+			do
+			{
+				addEntry(findData.cFileName);
+			}
+			while(::FindNextFileA(handle, &findData));
+			::FindClose(handle);
+		}
+#else
+		if(DIR* dir = opendir("."))
+		{
+			while(dirent* dirEntry = readdir(dir))
+				addEntry(dirEntry->d_name);
+			closedir(dir);
+		}
+#endif
+	}
+
+	bool GetFileInfo(const char* fileName, i64& outSize, i64& outModified)
+	{
+		struct stat fileStat;
+		if(stat(fileName, &fileStat) != 0)
+			return false;
+		outSize = (i64)fileStat.st_size;
+		outModified = (i64)fileStat.st_mtime;
+		return true;
+	}
+
+	bool CompareFileName(const RecordingEntry& a, const RecordingEntry& b)
+	{
+		return strcmp(a.fileName_, b.fileName_) < 0;
+	}
+
+	bool CompareID(const RecordingEntry& a, const RecordingEntry& b)
+	{
+		if(a.id_ != b.id_)
+			return a.id_ < b.id_;
+		return CompareFileName(a, b);
+	}
+
+	struct ScanJobData
+	{
+		Core::Vector<RecordingEntry>* entries_ = nullptr;
+		Core::Vector<i32>* toScan_ = nullptr;
+	};
+}
+
+RecordingCatalog::RecordingCatalog(const char* indexFileName)
+{
+	strcpy_s(indexFileName_, sizeof(indexFileName_), indexFileName);
+}
+
+RecordingCatalog::~RecordingCatalog()
+{
+}
+
+void RecordingCatalog::Scan()
+{
+	// Previous index, sorted by name to match against files on disk.
+	Core::Vector<RecordingEntry> indexed;
+	if(Core::FileExists(indexFileName_))
+	{
+		Core::File indexFile(indexFileName_, Core::FileFlags::READ);
+		IndexHeader header;
+		if(indexFile && indexFile.Read(&header, sizeof(header)) == sizeof(header) &&
+			header.id_ == TAG && header.version_ == VERSION && header.entrySize_ == sizeof(RecordingEntry))
+		{
+			const i32 numEntries = (i32)((indexFile.Size() - sizeof(header)) / sizeof(RecordingEntry));
+			indexed.resize(numEntries);
+			indexFile.Read(indexed.data(), sizeof(RecordingEntry) * numEntries);
+		}
+	}
+	std::sort(indexed.begin(), indexed.end(), CompareFileName);
+
+	Core::Vector<RecordingEntry> found;
+	FindRecordings(found);
+	std::sort(found.begin(), found.end(), CompareFileName);
+
+	// From names alone, so files that fail to scan still reserve their ID.
+	maxFileID_ = 0;
+	for(const auto& entry : found)
+	{
+		u32 id = 0;
+		if(sscanf(entry.fileName_, "audio_out_%u", &id) == 1)
+			maxFileID_ = Core::Max(maxFileID_, id);
+	}
+
+	// Reuse index entries for unchanged files, only scan the rest.
+	Core::Vector<i32> toScan;
+	entries_.clear();
+	i32 indexedIdx = 0;
+	for(auto& entry : found)
+	{
+		while(indexedIdx < indexed.size() && CompareFileName(indexed[indexedIdx], entry))
+			++indexedIdx;
+
+		i64 fileSize = 0;
+		i64 modified = 0;
+		if(!GetFileInfo(entry.fileName_, fileSize, modified))
+			continue;
+
+		if(indexedIdx < indexed.size() && strcmp(indexed[indexedIdx].fileName_, entry.fileName_) == 0 &&
+			indexed[indexedIdx].fileSize_ == fileSize)
+		{
+			entries_.push_back(indexed[indexedIdx]);
+		}
+		else
+		{
+			toScan.push_back(entries_.size());
+			entries_.push_back(entry);
+		}
+	}
+
+	// Headers only, spread over jobs.
+	if(toScan.size() > 0)
+	{
+		ScanJobData jobData;
+		jobData.entries_ = &entries_;
+		jobData.toScan_ = &toScan;
+
+		Core::Array<Job::JobDesc, SCAN_JOBS> jobDescs;
+		const i32 numJobs = Core::Min(SCAN_JOBS, toScan.size());
+		for(i32 jobIdx = 0; jobIdx < numJobs; ++jobIdx)
+		{
+			auto& jobDesc = jobDescs[jobIdx];
+			jobDesc.func_ = [](i32 param, void* data) {
+				ScanJobData* jobData = static_cast<ScanJobData*>(data);
+				const auto& toScan = *jobData->toScan_;
+				for(i32 idx = param; idx < toScan.size(); idx += SCAN_JOBS)
+				{
+					RecordingEntry& entry = (*jobData->entries_)[toScan[idx]];
+					if(!ScanFile(entry.fileName_, entry))
+						entry.numChannels_ = 0;
+				}
+			};
+			jobDesc.param_ = jobIdx;
+			jobDesc.data_ = &jobData;
+			jobDesc.name_ = "RecordingCatalog scan";
+		}
+
+		Job::Counter* counter = nullptr;
+		Job::Manager::RunJobs(jobDescs.data(), numJobs, &counter);
+		Job::Manager::WaitForCounter(counter, 0);
+
+		// Drop anything that couldn't be read.
+		entries_.erase(std::remove_if(entries_.begin(), entries_.end(),
+			[](const RecordingEntry& entry) { return entry.numChannels_ == 0; }), entries_.end());
+	}
+
+	std::sort(entries_.begin(), entries_.end(), CompareID);
+	if(toScan.size() > 0 || entries_.size() != indexed.size())
+		SaveIndex();
+}
+
+void RecordingCatalog::Add(const char* fileName)
+{
+	RecordingEntry entry;
+	if(!ScanFile(fileName, entry))
+		return;
+
+	Core::ScopedMutex lock(addedMutex_);
+	const bool exists = Core::FileExists(indexFileName_);
+	Core::File indexFile(indexFileName_, exists ? (Core::FileFlags::WRITE | Core::FileFlags::APPEND) : (Core::FileFlags::CREATE | Core::FileFlags::WRITE));
+	if(indexFile)
+	{
+		if(!exists)
+		{
+			IndexHeader header;
+			indexFile.Write(&header, sizeof(header));
+		}
+		indexFile.Write(&entry, sizeof(entry));
+	}
+
+	added_.push_back(entry);
+	Core::AtomicInc(&numAdded_);
+}
+
+bool RecordingCatalog::Update()
+{
+	if(Core::AtomicExchg(&numAdded_, 0) == 0)
+		return false;
+
+	Core::ScopedMutex lock(addedMutex_);
+	for(const auto& entry : added_)
+	{
+		auto it = std::find_if(entries_.begin(), entries_.end(),
+			[&entry](const RecordingEntry& other) { return strcmp(entry.fileName_, other.fileName_) == 0; });
+		if(it != entries_.end())
+			*it = entry;
+		else
+			entries_.push_back(entry);
+	}
+	added_.clear();
+	return true;
+}
+
+u32 RecordingCatalog::GetMaxID() const
+{
+	u32 maxID = maxFileID_;
+	for(const auto& entry : entries_)
+		maxID = Core::Max(maxID, entry.id_);
+	return maxID;
+}
+
+bool RecordingCatalog::ScanFile(const char* fileName, RecordingEntry& outEntry)
+{
+	if(strlen(fileName) >= RecordingEntry::FILE_NAME_LENGTH)
+		return false;
+
+	outEntry = RecordingEntry();
+	strcpy_s(outEntry.fileName_, sizeof(outEntry.fileName_), fileName);
+	if(!GetFileInfo(fileName, outEntry.fileSize_, outEntry.modified_))
+		return false;
+
+	Sound::InputStream stream(fileName);
+	if(!stream)
+		return false;
+	outEntry.numFrames_ = stream.GetNumFrames();
+	outEntry.numChannels_ = stream.GetNumChannels();
+	outEntry.sampleRate_ = stream.GetSampleRate();
+	sscanf(fileName, "audio_out_%u", &outEntry.id_);
+
+	// Top of the peak pyramid summarises the whole file.
+	Core::Array<char, Core::MAX_PATH_LENGTH> sidecarName;
+	Sound::PeakPyramid::GetSidecarName(fileName, sidecarName.data(), sidecarName.size());
+	if(Core::FileExists(sidecarName.data()))
+	{
+		Sound::PeakPyramid peaks;
+		Core::File sidecarFile(sidecarName.data(), Core::FileFlags::READ);
+		if(sidecarFile && peaks.Load(sidecarFile, outEntry.fileSize_))
+		{
+			f32 sumSquares = 0.0f;
+			for(i32 ch = 0; ch < peaks.GetNumChannels(); ++ch)
+			{
+				Sound::Peak peak;
+				peaks.GetPeaks(ch, 0, peaks.GetNumFrames(), &peak, 1);
+				outEntry.peak_ = Core::Max(outEntry.peak_, Core::Max(peak.max_, -peak.min_));
+				sumSquares += peak.rms_ * peak.rms_;
+			}
+			outEntry.rms_ = std::sqrt(sumSquares / Core::Max(peaks.GetNumChannels(), 1));
+		}
+	}
+	return true;
+}
+
+void RecordingCatalog::SaveIndex()
+{
+	Core::ScopedMutex lock(addedMutex_);
+	if(Core::FileExists(indexFileName_))
+		Core::FileRemove(indexFileName_);
+
+	Core::File indexFile(indexFileName_, Core::FileFlags::CREATE | Core::FileFlags::WRITE);
+	if(indexFile)
+	{
+		IndexHeader header;
+		indexFile.Write(&header, sizeof(header));
+		indexFile.Write(entries_.data(), sizeof(RecordingEntry) * entries_.size());
+	}
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "core/concurrency.h"
+#include "core/types.h"
+#include "core/vector.h"
+
+/**
+ * Catalog entry for a single recording file.
+ * Stored as is in the binary index.
+ */
+struct RecordingEntry
+{
+	static const i32 FILE_NAME_LENGTH = 128;
+
+	i64 numFrames_ = 0;
+	/// Size of file when scanned, to detect changes.
+	i64 fileSize_ = 0;
+	/// Last modification, in seconds since epoch. Creation time isn't portable, and recordings aren't modified once finalised.
+	i64 modified_ = 0;
+	u32 id_ = 0;
+	i32 numChannels_ = 0;
+	i32 sampleRate_ = 0;
+	/// Peak & RMS over all channels, from the peak sidecar. 0 if there isn't one.
+	f32 peak_ = 0.0f;
+	f32 rms_ = 0.0f;
+	u32 reserved_ = 0;
+	char fileName_[FILE_NAME_LENGTH] = {};
+
+	f64 GetDuration() const { return sampleRate_ > 0 ? (f64)numFrames_ / (f64)sampleRate_ : 0.0; }
+};
+
+/**
+ * Persistent catalog of recordings, so takes from previous sessions can be listed
+ * without touching every file each frame.
+ * Entries are only read & modified on the main thread. Recordings added from jobs are queued,
+ * and picked up by Update.
+ */
+class RecordingCatalog
+{
+public:
+	RecordingCatalog(const char* indexFileName = "recordings.idx");
+	~RecordingCatalog();
+
+	/**
+	 * Load index, then scan headers of recordings that are new or changed on jobs, and rewrite the index.
+	 * Call once at startup.
+	 */
+	void Scan();
+
+	/**
+	 * Add a finalised recording, appending it to the index. Thread safe.
+	 */
+	void Add(const char* fileName);
+
+	/**
+	 * Pick up recordings added since the last call.
+	 * @return true if entries changed.
+	 */
+	bool Update();
+
+	i32 GetNumEntries() const { return entries_.size(); }
+	const RecordingEntry& GetEntry(i32 idx) const { return entries_[idx]; }
+
+	/// Highest ID of any recording file found by Scan or added since, including files that couldn't be read,
+	/// so new recordings don't overwrite old ones.
+	u32 GetMaxID() const;
+
+	/**
+	 * Read file headers & peak sidecar into @a outEntry.
+	 */
+	static bool ScanFile(const char* fileName, RecordingEntry& outEntry);
+
+private:
+	void SaveIndex();
+
+	char indexFileName_[RecordingEntry::FILE_NAME_LENGTH] = {};
+	Core::Vector<RecordingEntry> entries_;
+	/// Highest ID of recording files on disk when scanned.
+	u32 maxFileID_ = 0;
+
+	/// Entries added from other threads, not yet in entries_.
+	Core::Mutex addedMutex_;
+	Core::Vector<RecordingEntry> added_;
+	volatile i32 numAdded_ = 0;
+};
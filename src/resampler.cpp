@@ -0,0 +1,161 @@
+#include "resampler.h"
+#include "core/misc.h"
+
+#include "ispc/resampler_ispc.h"
+
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+	struct QualityParams
+	{
+		i32 numTaps_;
+		/// Kaiser window beta.
+		f64 beta_;
+		/// Passband edge, as a fraction of the lower Nyquist frequency.
+		f64 rolloff_;
+	};
+
+	const QualityParams QUALITY_PARAMS[] =
+	{
+		{ 8, 5.0, 0.80 },
+		{ 16, 7.0, 0.88 },
+		{ 32, 9.5, 0.92 },
+		{ 64, 12.0, 0.95 },
+	};
+
+	/// Zeroth order modified Bessel function of the first kind.
+	f64 BesselI0(f64 x)
+	{
+		f64 sum = 1.0;
+		f64 term = 1.0;
+		for(i32 k = 1; k < 32; ++k)
+		{
+			term *= (x / (2.0 * k)) * (x / (2.0 * k));
+			sum += term;
+			if(term < sum * 1e-12)
+				break;
+		}
+		return sum;
+	}
+}
+
+Resampler::Resampler(i32 numChannels, i32 inRate, i32 outRate, ResamplerQuality quality)
+	: numChannels_(numChannels)
+	, inRate_(inRate)
+	, outRate_(outRate)
+{
+	const auto& params = QUALITY_PARAMS[(i32)quality];
+	numTaps_ = params.numTaps_;
+	step_ = (f64)inRate_ / (f64)outRate_;
+
+	// Low pass at the lower of the two Nyquist frequencies, relative to the input rate.
+	const f64 pi = 3.14159265358979323846;
+	const f64 cutoff = 0.5 * params.rolloff_ * Core::Min(1.0, 1.0 / step_);
+	const f64 halfTaps = numTaps_ * 0.5;
+	const f64 windowScale = 1.0 / BesselI0(params.beta_);
+	filters_.resize((NUM_PHASES + 1) * numTaps_);
+	for(i32 phase = 0; phase <= NUM_PHASES; ++phase)
+	{
+		// Output lies between taps halfTaps - 1 & halfTaps, offset by phase.
+		const f64 frac = (f64)phase / (f64)NUM_PHASES;
+		f64 sum = 0.0;
+		f32* filter = filters_.data() + phase * numTaps_;
+		for(i32 k = 0; k < numTaps_; ++k)
+		{
+			const f64 x = (f64)k - (halfTaps - 1.0) - frac;
+			const f64 sinc = x == 0.0 ? 1.0 : std::sin(2.0 * pi * cutoff * x) / (pi * x * 2.0 * cutoff);
+			const f64 w = x / halfTaps;
+			const f64 window = w * w < 1.0 ? BesselI0(params.beta_ * std::sqrt(1.0 - w * w)) * windowScale : 0.0;
+			const f64 value = 2.0 * cutoff * sinc * window;
+			filter[k] = (f32)value;
+			sum += value;
+		}
+
+		// Normalise for unity gain at DC.
+		for(i32 k = 0; k < numTaps_; ++k)
+			filter[k] = (f32)(filter[k] / sum);
+	}
+
+	capacity_ = numTaps_ + BLOCK_FRAMES;
+	history_.resize(capacity_ * numChannels_);
+	Reset();
+}
+
+Resampler::~Resampler()
+{
+}
+
+void Resampler::Reset()
+{
+	// Prime with silence so the first output is aligned with the first input.
+	memset(history_.data(), 0, sizeof(f32) * history_.size());
+	size_ = numTaps_ / 2 - 1;
+	time_ = 0.0;
+}
+
+i32 Resampler::Process(const f32* in, i32 numIn, i32& outNumConsumed, f32* out, i32 maxOut)
+{
+	outNumConsumed = 0;
+	i32 numProduced = 0;
+	for(;;)
+	{
+		// Append input to history.
+		const i32 numAppend = Core::Min(capacity_ - size_, numIn - outNumConsumed);
+		for(i32 ch = 0; ch < numChannels_; ++ch)
+		{
+			f32* channel = history_.data() + ch * capacity_ + size_;
+			if(in)
+			{
+				const f32* inChannel = in + outNumConsumed * numChannels_ + ch;
+				for(i32 i = 0; i < numAppend; ++i)
+					channel[i] = inChannel[i * numChannels_];
+			}
+			else
+			{
+				memset(channel, 0, sizeof(f32) * numAppend);
+			}
+		}
+		size_ += numAppend;
+		outNumConsumed += numAppend;
+
+		// Produce as much output as the history allows.
+		i32 numOut = 0;
+		const f64 available = (f64)(size_ - numTaps_) - time_;
+		if(available >= 0.0)
+			numOut = Core::Min((i32)(available / step_) + 1, maxOut - numProduced);
+		if(numOut > 0)
+		{
+			for(i32 ch = 0; ch < numChannels_; ++ch)
+			{
+				ispc::resampler_process(history_.data() + ch * capacity_, filters_.data(), numTaps_, NUM_PHASES,
+					time_, step_, out + numProduced * numChannels_ + ch, numChannels_, numOut);
+			}
+			time_ += numOut * step_;
+			numProduced += numOut;
+		}
+
+		// Discard history that's no longer needed.
+		const i32 numDiscard = Core::Min((i32)time_, size_);
+		if(numDiscard > 0)
+		{
+			for(i32 ch = 0; ch < numChannels_; ++ch)
+			{
+				f32* channel = history_.data() + ch * capacity_;
+				memmove(channel, channel + numDiscard, sizeof(f32) * (size_ - numDiscard));
+			}
+			size_ -= numDiscard;
+			time_ -= numDiscard;
+		}
+
+		if(numAppend == 0 && numOut == 0)
+			break;
+	}
+	return numProduced;
+}
+
+i64 Resampler::GetNumOutputFrames(i64 numIn) const
+{
+	return ((numIn * outRate_) + inRate_ - 1) / inRate_;
+}
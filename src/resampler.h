@@ -0,0 +1,81 @@
+#pragma once
+
+#include "core/types.h"
+#include "core/vector.h"
+
+/// Resampler quality, trading CPU for stopband attenuation.
+enum class ResamplerQuality
+{
+	/// 8 taps, ~45dB.
+	LOW = 0,
+	/// 16 taps, ~70dB.
+	MEDIUM,
+	/// 32 taps, ~95dB.
+	HIGH,
+	/// 64 taps, ~120dB.
+	BEST,
+};
+
+/**
+ * Polyphase windowed-sinc sample rate converter for arbitrary ratios.
+ * State is kept between calls so a stream can be processed in blocks of any size.
+ * Process doesn't allocate, so is safe to use on the audio thread.
+ */
+class Resampler
+{
+public:
+	Resampler(i32 numChannels, i32 inRate, i32 outRate, ResamplerQuality quality = ResamplerQuality::MEDIUM);
+	~Resampler();
+
+	Resampler(const Resampler&) = delete;
+	Resampler& operator=(const Resampler&) = delete;
+
+	/**
+	 * Clear history, as if starting a new stream.
+	 */
+	void Reset();
+
+	/**
+	 * Resample interleaved frames.
+	 * @param in Input frames, or nullptr to feed silence, used to flush the tail of a stream.
+	 * @param numIn Number of input frames available.
+	 * @param outNumConsumed Number of input frames consumed.
+	 * @param out Output frames.
+	 * @param maxOut Maximum number of output frames to produce.
+	 * @return Number of output frames produced.
+	 */
+	i32 Process(const f32* in, i32 numIn, i32& outNumConsumed, f32* out, i32 maxOut);
+
+	/**
+	 * Number of output frames produced by @a numIn input frames, rounded up.
+	 */
+	i64 GetNumOutputFrames(i64 numIn) const;
+
+	i32 GetNumChannels() const { return numChannels_; }
+	i32 GetInRate() const { return inRate_; }
+	i32 GetOutRate() const { return outRate_; }
+	f64 GetRatio() const { return step_; }
+
+private:
+	/// Input frames buffered per call, on top of filter history.
+	static const i32 BLOCK_FRAMES = 1024;
+	/// Number of filter phases.
+	static const i32 NUM_PHASES = 256;
+
+	i32 numChannels_ = 0;
+	i32 inRate_ = 0;
+	i32 outRate_ = 0;
+	i32 numTaps_ = 0;
+	/// Input frames per output frame.
+	f64 step_ = 1.0;
+
+	/// (NUM_PHASES + 1) * numTaps_ coefficients.
+	Core::Vector<f32> filters_;
+
+	/// Non-interleaved input history, capacity_ frames per channel.
+	Core::Vector<f32> history_;
+	i32 capacity_ = 0;
+	i32 size_ = 0;
+	/// Position of next output in history, in input frames.
+	f64 time_ = 0.0;
+};
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "core/concurrency.h"
+#include "core/misc.h"
+#include "core/vector.h"
+
+#include <cstring>
+
+/**
+ * Lock-free single producer, single consumer ring buffer.
+ * Only one thread may write and one thread may read at a time.
+ * Capacity is rounded up to a power of two.
+ */
+template<typename TYPE>
+class RingBuffer
+{
+public:
+	RingBuffer() = default;
+	RingBuffer(i32 capacity) { Resize(capacity); }
+
+	RingBuffer(const RingBuffer&) = delete;
+	RingBuffer& operator=(const RingBuffer&) = delete;
+
+	/**
+	 * Resize and clear buffer.
+	 * @pre Neither producer nor consumer are active.
+	 */
+	void Resize(i32 capacity)
+	{
+		i32 size = 1;
+		while(size < capacity)
+			size <<= 1;
+		data_.clear();
+		data_.resize(size);
+		mask_ = size - 1;
+		readPos_ = 0;
+		writePos_ = 0;
+	}
+
+	/**
+	 * Clear buffer.
+	 * @pre Neither producer nor consumer are active.
+	 */
+	void Reset()
+	{
+		readPos_ = 0;
+		writePos_ = 0;
+	}
+
+	i32 GetCapacity() const { return data_.size(); }
+	i32 GetNumReadable() const { return (i32)((u32)writePos_ - (u32)readPos_); }
+	i32 GetNumWritable() const { return GetCapacity() - GetNumReadable(); }
+
+	/**
+	 * Producer: write up to @a num elements.
+	 * @return Number of elements written.
+	 */
+	i32 Write(const TYPE* data, i32 num)
+	{
+		num = Core::Min(num, GetNumWritable());
+		const u32 writePos = (u32)writePos_;
+		const i32 offset = (i32)(writePos & mask_);
+		const i32 firstNum = Core::Min(num, GetCapacity() - offset);
+		memcpy(data_.data() + offset, data, sizeof(TYPE) * firstNum);
+		memcpy(data_.data(), data + firstNum, sizeof(TYPE) * (num - firstNum));
+		Core::AtomicExchg(&writePos_, (i32)(writePos + num));
+		return num;
+	}
+
+	/**
+	 * Consumer: read up to @a num elements.
+	 * @return Number of elements read.
+	 */
+	i32 Read(TYPE* data, i32 num)
+	{
+		num = Core::Min(num, GetNumReadable());
+		const u32 readPos = (u32)readPos_;
+		const i32 offset = (i32)(readPos & mask_);
+		const i32 firstNum = Core::Min(num, GetCapacity() - offset);
+		memcpy(data, data_.data() + offset, sizeof(TYPE) * firstNum);
+		memcpy(data + firstNum, data_.data(), sizeof(TYPE) * (num - firstNum));
+		Core::AtomicExchg(&readPos_, (i32)(readPos + num));
+		return num;
+	}
+
+	/**
+	 * Consumer: discard up to @a num elements.
+	 * @return Number of elements discarded.
+	 */
+	i32 Skip(i32 num)
+	{
+		num = Core::Min(num, GetNumReadable());
+		Core::AtomicExchg(&readPos_, (i32)((u32)readPos_ + num));
+		return num;
+	}
+
+private:
+	Core::Vector<TYPE> data_;
+	u32 mask_ = 0;
+	volatile i32 readPos_ = 0;
+	volatile i32 writePos_ = 0;
+};
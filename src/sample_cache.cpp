@@ -0,0 +1,247 @@
+#include "sample_cache.h"
+#include "sound.h"
+#include "core/array.h"
+#include "core/file.h"
+
+#include <sys/stat.h>
+
+#include <cstring>
+#include <utility>
+
+namespace Sound
+{
+	struct CacheEntry
+	{
+		Core::Array<char, Core::MAX_PATH_LENGTH> fileName_;
+		i64 fileSize_ = 0;
+		i64 modified_ = 0;
+		Data data_;
+		volatile i32 refCount_ = 0;
+		u64 lastUsed_ = 0;
+		/// File has changed since loading, remove once unreferenced.
+		bool stale_ = false;
+	};
+
+	namespace
+	{
+		bool GetFileInfo(const char* fileName, i64& outSize, i64& outModified)
+		{
+			struct stat fileStat;
+			if(stat(fileName, &fileStat) != 0)
+				return false;
+			outSize = (i64)fileStat.st_size;
+			outModified = (i64)fileStat.st_mtime;
+			return true;
+		}
+	}
+
+	CachedData::CachedData(CacheEntry* entry)
+		: entry_(entry)
+	{
+		if(entry_)
+			Core::AtomicInc(&entry_->refCount_);
+	}
+
+	CachedData::CachedData(const CachedData& other)
+		: CachedData(other.entry_)
+	{
+	}
+
+	CachedData::CachedData(CachedData&& other)
+	{
+		swap(other);
+	}
+
+	CachedData& CachedData::operator=(CachedData other)
+	{
+		swap(other);
+		return *this;
+	}
+
+	CachedData::~CachedData()
+	{
+		if(entry_)
+			Core::AtomicDec(&entry_->refCount_);
+	}
+
+	void CachedData::swap(CachedData& other)
+	{
+		std::swap(entry_, other.entry_);
+	}
+
+	const Data& CachedData::GetData() const
+	{
+		return entry_->data_;
+	}
+
+	const f32* CachedData::GetSamples() const
+	{
+		return reinterpret_cast<const f32*>(entry_->data_.rawData_);
+	}
+
+	SampleCache::SampleCache(i64 budget)
+		: budget_(budget)
+	{
+	}
+
+	SampleCache::~SampleCache()
+	{
+		for(auto* entry : entries_)
+			delete entry;
+	}
+
+	CachedData SampleCache::Get(const char* fileName)
+	{
+		i64 fileSize = 0;
+		i64 modified = 0;
+		if(!GetFileInfo(fileName, fileSize, modified))
+			return CachedData();
+
+		for(;;)
+		{
+			{
+				Core::ScopedMutex lock(mutex_);
+				if(CacheEntry* entry = FindEntry(fileName, fileSize, modified))
+					return CachedData(entry);
+				if(!IsLoadingLocked(fileName))
+				{
+					loading_.push_back(fileName);
+					break;
+				}
+			}
+
+			// Another consumer is decoding it, wait for its copy rather than decoding it twice.
+			Core::Sleep(0.001);
+		}
+
+		// Decode without holding the lock, so other sounds can be fetched meanwhile.
+		Data data;
+		{
+			Core::File file(fileName, Core::FileFlags::READ);
+			if(file)
+				data = Load(file);
+		}
+		if(data && data.format_ != Format::F32)
+			data = Convert(data, Format::F32);
+
+		Core::ScopedMutex lock(mutex_);
+		for(i32 idx = 0; idx < loading_.size(); ++idx)
+		{
+			if(loading_[idx] == fileName)
+			{
+				loading_.erase(loading_.begin() + idx);
+				break;
+			}
+		}
+		if(!data)
+			return CachedData();
+
+		CacheEntry* entry = new CacheEntry();
+		strcpy_s(entry->fileName_.data(), entry->fileName_.size(), fileName);
+		entry->fileSize_ = fileSize;
+		entry->modified_ = modified;
+		entry->data_ = std::move(data);
+		entry->lastUsed_ = ++useCounter_;
+		entries_.push_back(entry);
+		Core::AtomicAdd(&usage_, entry->data_.numBytes_);
+
+		// Reference before trimming so the new entry can't be evicted.
+		CachedData cachedData(entry);
+		TrimLocked();
+		return cachedData;
+	}
+
+	bool SampleCache::IsLoadingLocked(const char* fileName) const
+	{
+		for(const char* loadingName : loading_)
+			if(strcmp(loadingName, fileName) == 0)
+				return true;
+		return false;
+	}
+
+	CachedData SampleCache::Find(const char* fileName)
+	{
+		i64 fileSize = 0;
+		i64 modified = 0;
+		if(!GetFileInfo(fileName, fileSize, modified))
+			return CachedData();
+
+		Core::ScopedMutex lock(mutex_);
+		return CachedData(FindEntry(fileName, fileSize, modified));
+	}
+
+	void SampleCache::Trim()
+	{
+		Core::ScopedMutex lock(mutex_);
+		TrimLocked();
+	}
+
+	void SampleCache::SetBudget(i64 budget)
+	{
+		Core::ScopedMutex lock(mutex_);
+		budget_ = budget;
+		TrimLocked();
+	}
+
+	i32 SampleCache::GetNumEntries() const
+	{
+		Core::ScopedMutex lock(mutex_);
+		return entries_.size();
+	}
+
+	CacheEntry* SampleCache::FindEntry(const char* fileName, i64 fileSize, i64 modified)
+	{
+		for(auto* entry : entries_)
+		{
+			if(entry->stale_ || strcmp(entry->fileName_.data(), fileName) != 0)
+				continue;
+
+			if(entry->fileSize_ != fileSize || entry->modified_ != modified)
+			{
+				entry->stale_ = true;
+				continue;
+			}
+
+			entry->lastUsed_ = ++useCounter_;
+			return entry;
+		}
+		return nullptr;
+	}
+
+	void SampleCache::TrimLocked()
+	{
+		// Entries can only gain references under the lock, so unreferenced ones are safe to free.
+		for(i32 idx = 0; idx < entries_.size(); )
+		{
+			CacheEntry* entry = entries_[idx];
+			if(entry->stale_ && entry->refCount_ == 0)
+			{
+				Core::AtomicAdd(&usage_, -entry->data_.numBytes_);
+				delete entry;
+				entries_.erase(entries_.begin() + idx);
+			}
+			else
+			{
+				++idx;
+			}
+		}
+
+		while(usage_ > budget_)
+		{
+			i32 lruIdx = -1;
+			for(i32 idx = 0; idx < entries_.size(); ++idx)
+			{
+				const CacheEntry* entry = entries_[idx];
+				if(entry->refCount_ == 0 && (lruIdx < 0 || entry->lastUsed_ < entries_[lruIdx]->lastUsed_))
+					lruIdx = idx;
+			}
+			if(lruIdx < 0)
+				break;
+
+			CacheEntry* entry = entries_[lruIdx];
+			Core::AtomicAdd(&usage_, -entry->data_.numBytes_);
+			delete entry;
+			entries_.erase(entries_.begin() + lruIdx);
+		}
+	}
+} // namespace Sound
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "core/concurrency.h"
+#include "core/types.h"
+#include "core/vector.h"
+
+namespace Sound
+{
+	struct Data;
+	struct CacheEntry;
+
+	/**
+	 * Reference to decoded sound held by a SampleCache. Copies share the same samples.
+	 * Releasing a reference never frees memory, so it is safe on the audio thread.
+	 */
+	class CachedData
+	{
+	public:
+		CachedData() = default;
+		CachedData(const CachedData& other);
+		CachedData(CachedData&& other);
+		CachedData& operator=(CachedData other);
+		~CachedData();
+		void swap(CachedData& other);
+		explicit operator bool() const { return entry_ != nullptr; }
+
+		/// Decoded sound, always interleaved f32.
+		const Data& GetData() const;
+		const f32* GetSamples() const;
+
+	private:
+		friend class SampleCache;
+		CachedData(CacheEntry* entry);
+
+		CacheEntry* entry_ = nullptr;
+	};
+
+	/**
+	 * Shared cache of decoded sounds, keyed by file name & modification time.
+	 * Unreferenced sounds are evicted least recently used first once over budget.
+	 * Referenced sounds are never evicted, so usage can temporarily exceed the budget.
+	 */
+	class SampleCache
+	{
+	public:
+		static const i64 DEFAULT_BUDGET = 512 * 1024 * 1024;
+
+		SampleCache(i64 budget = DEFAULT_BUDGET);
+		~SampleCache();
+		SampleCache(const SampleCache&) = delete;
+		SampleCache& operator=(const SampleCache&) = delete;
+
+		/**
+		 * Get decoded sound, loading it if it isn't cached or the file has changed.
+		 * Blocks while loading, so call from a job or non-realtime thread.
+		 */
+		CachedData Get(const char* fileName);
+
+		/**
+		 * Get decoded sound only if it's already cached & up to date.
+		 */
+		CachedData Find(const char* fileName);
+
+		/**
+		 * Evict unreferenced & stale sounds until within budget.
+		 */
+		void Trim();
+
+		void SetBudget(i64 budget);
+		i64 GetBudget() const { return budget_; }
+		i64 GetUsage() const { return usage_; }
+		i32 GetNumEntries() const;
+
+	private:
+		CacheEntry* FindEntry(const char* fileName, i64 fileSize, i64 modified);
+		void TrimLocked();
+		bool IsLoadingLocked(const char* fileName) const;
+
+		mutable Core::Mutex mutex_;
+		Core::Vector<CacheEntry*> entries_;
+		/// Names of sounds being decoded by Get, so concurrent consumers share one decode.
+		Core::Vector<const char*> loading_;
+		i64 budget_ = 0;
+		volatile i64 usage_ = 0;
+		/// Incremented on each use, for LRU.
+		u64 useCounter_ = 0;
+	};
+} // namespace Sound
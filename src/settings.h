@@ -10,6 +10,8 @@ namespace App
 	{
 		AudioDeviceSettings audioSettings_;
 		MidiDeviceSettings midiSettings_;
+		/// Memory budget for decoded sounds kept for playback.
+		i32 sampleCacheMB_ = 512;
 
 		void Save();
 		void Load();
@@ -18,6 +20,7 @@ namespace App
 		{
 			ser.SerializeObject("audioSettings", audioSettings_);
 			ser.SerializeObject("midiSettings", midiSettings_);
+			ser.Serialize("sampleCacheMB", sampleCacheMB_);
 			return true;
 		}
 	};
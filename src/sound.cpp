@@ -1,10 +1,18 @@
 #include "sound.h"
+#include "audio_rt_check.h"
+#include "lossless.h"
+#include "peak_pyramid.h"
+#include "pre_roll_buffer.h"
+#include "ring_buffer.h"
 #include "core/array.h"
 #include "core/concurrency.h"
 #include "core/file.h"
+#include "core/misc.h"
 #include "core/vector.h"
 #include "job/manager.h"
 
+#include "ispc/convert_ispc.h"
+
 #pragma warning(push)
 #pragma warning(disable:4244)
 #pragma warning(disable:4245)
@@ -15,6 +23,17 @@
 #include "stb_vorbis.c"
 #pragma warning(pop)
 
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include <utility>
 
 namespace Sound
@@ -37,6 +56,21 @@ namespace Sound
 
 		static const u32 WAVE_ID = 'EVAW';
 
+		/// Replaces RIFF once sizes don't fit in 32 bits. Real sizes are in the ds64 chunk.
+		static const u32 RF64_ID = '46FR';
+		/// 32 bit sizes set to this defer to the ds64 chunk.
+		static const u32 RF64_SIZE = 0xffffffff;
+
+		/**
+		 * Written field by field, as the 64 bit members would otherwise be padded.
+		 * u64 riffSize, u64 dataSize, u64 sampleCount, u32 tableLength.
+		 */
+		struct DS64Chunk
+		{
+			static const u32 ID = '46sd';
+			static const u32 SIZE = 28;
+		};
+
 		struct FmtChunk
 		{
 			static const u32 ID = ' tmf';
@@ -49,6 +83,17 @@ namespace Sound
 			u16 bitsPerSample_ = 0;
 		};
 
+		static const u16 EXTENSIBLE_FORMAT = 0xfffe;
+
+		struct FmtExtension
+		{
+			u16 size_ = 0;
+			u16 validBitsPerSample_ = 0;
+			u32 channelMask_ = 0;
+			/// First 2 bytes of the sub format GUID.
+			u16 subFormat_ = 0;
+		};
+
 		struct FACTChunk
 		{
 			static const u32 ID = 'tcaf';
@@ -73,7 +118,7 @@ namespace Sound
 		{
 			Chunk chunk;
 			file.Read(&chunk, sizeof(chunk));
-			if(chunk.id_== RIFFChunk::ID)
+			if(chunk.id_== RIFFChunk::ID || chunk.id_ == RF64_ID)
 			{
 				RIFFChunk riffChunk;
 
@@ -86,15 +131,19 @@ namespace Sound
 			return false;
 		}
 
-		void ReadChunks(Core::File& file, Data& data)
+		/**
+		 * Read chunks into @a data. If @a outDataOffset is set, the data chunk is
+		 * left on disk and its offset is returned instead.
+		 */
+		void ReadChunks(Core::File& file, Data& data, i64* outDataOffset = nullptr)
 		{
-			i64 fileSize = file.Size();
-			(void)fileSize;
+			const i64 fileSize = file.Size();
 
 			Chunk chunk;
 			FmtChunk fmtChunk;
 			FACTChunk factChunk;
 			PEAKChunk peakChunk;
+			i64 ds64DataSize = -1;
 			while(file.Read(&chunk, sizeof(chunk)) == sizeof(chunk))
 			{
 				i64 chunkEnd = file.Tell() + chunk.size_;
@@ -106,9 +155,23 @@ namespace Sound
 						file.Read(&fmtChunk, sizeof(fmtChunk));
 						data.sampleRate_ = fmtChunk.sampleRate_;
 						data.numChannels_ = fmtChunk.numChannels_;
-						if(fmtChunk.audioFormat_ == 1 && fmtChunk.bitsPerSample_ == 16)
+
+						// WAVE_FORMAT_EXTENSIBLE stores the real format at the start of the sub format GUID.
+						u16 audioFormat = fmtChunk.audioFormat_;
+						if(audioFormat == EXTENSIBLE_FORMAT && chunk.size_ >= sizeof(FmtChunk) + sizeof(FmtExtension))
+						{
+							FmtExtension fmtExtension;
+							file.Read(&fmtExtension, sizeof(fmtExtension));
+							audioFormat = fmtExtension.subFormat_;
+						}
+
+						if(audioFormat == 1 && fmtChunk.bitsPerSample_ == 16)
 							data.format_ = Format::S16;
-						else if(fmtChunk.audioFormat_ == 3 && fmtChunk.bitsPerSample_ == 32)
+						else if(audioFormat == 1 && fmtChunk.bitsPerSample_ == 24)
+							data.format_ = Format::S24;
+						else if(audioFormat == 1 && fmtChunk.bitsPerSample_ == 32)
+							data.format_ = Format::S32;
+						else if(audioFormat == 3 && fmtChunk.bitsPerSample_ == 32)
 							data.format_ = Format::F32;
 					}
 					break;
@@ -125,13 +188,37 @@ namespace Sound
 					}
 					break;
 
-				case DataChunk::ID:
+				case DS64Chunk::ID:
 					{
-						data.numBytes_ = chunk.size_;
-						data.numSamples_ = chunk.size_ / ((fmtChunk.bitsPerSample_ * fmtChunk.numChannels_) / 8);
+						u64 riffSize = 0;
+						u64 dataSize = 0;
+						file.Read(&riffSize, sizeof(riffSize));
+						if(file.Read(&dataSize, sizeof(dataSize)) == sizeof(dataSize))
+							ds64DataSize = (i64)dataSize;
+					}
+					break;
 
-						data.rawData_ = new u8[data.numBytes_];
-						file.Read(data.rawData_, data.numBytes_);
+				case DataChunk::ID:
+					{
+						// Streams which weren't finalized have an unknown size, so clamp to what's in the file.
+						i64 dataSize = chunk.size_;
+						if(chunk.size_ == RF64_SIZE)
+							dataSize = ds64DataSize >= 0 ? ds64DataSize : fileSize - file.Tell();
+						dataSize = Core::Min(dataSize, fileSize - file.Tell());
+						chunkEnd = file.Tell() + dataSize;
+						const i64 frameSize = (fmtChunk.bitsPerSample_ * fmtChunk.numChannels_) / 8;
+						data.numBytes_ = dataSize;
+						data.numSamples_ = frameSize > 0 ? dataSize / frameSize : 0;
+
+						if(outDataOffset)
+						{
+							*outDataOffset = file.Tell();
+						}
+						else
+						{
+							data.rawData_ = new u8[data.numBytes_];
+							file.Read(data.rawData_, data.numBytes_);
+						}
 					}
 					break;
 				}
@@ -152,8 +239,128 @@ namespace Sound
 		}
 
 
+		void SetupFmtChunk(FmtChunk& fmtChunk, Format format, i32 numChannels, i32 sampleRate)
+		{
+			switch(format)
+			{
+			case Format::S16:
+			case Format::S24:
+			case Format::S32:
+				fmtChunk.audioFormat_ = 1;
+				break;
+			case Format::F32:
+				fmtChunk.audioFormat_ = 3;
+				break;
+			default:
+				break;
+			}
+
+			fmtChunk.bitsPerSample_ = (u16)(GetSampleSize(format) * 8);
+			fmtChunk.blockAlign_ = (u16)(GetSampleSize(format) * numChannels);
+			fmtChunk.numChannels_ = (u16)numChannels;
+			fmtChunk.sampleRate_ = sampleRate;
+			fmtChunk.byteRate_ = (fmtChunk.numChannels_ * fmtChunk.bitsPerSample_ * fmtChunk.sampleRate_) / 8;
+		}
+
+		/// JUNK chunk reserved in streamed headers, directly after the RIFF header, to be replaced by a ds64 chunk.
+		static const u32 STREAM_JUNK_SIZE = DS64Chunk::SIZE;
+		static const i64 STREAM_JUNK_OFFSET = sizeof(Chunk) + sizeof(RIFFChunk);
+		static const u32 JUNK_ID = 'KNUJ';
+		/// Data size written until a stream is finalized. Readers clamp it to the file size.
+		static const u32 STREAM_UNKNOWN_SIZE = 0xffffffff;
+
+		/**
+		 * Write header for a stream whose length isn't known yet. Sample data follows directly.
+		 * @return Offset of the data chunk's size field, for FinalizeStream.
+		 */
+		i64 WriteStreamHeader(Core::File& file, Format format, i32 numChannels, i32 sampleRate)
+		{
+			Chunk chunk;
+			RIFFChunk riffChunk;
+			FmtChunk fmtChunk;
+
+			chunk.id_ = RIFFChunk::ID;
+			chunk.size_ = STREAM_UNKNOWN_SIZE;
+			riffChunk.format_ = WAVE_ID;
+			file.Write(&chunk, sizeof(chunk));
+			file.Write(&riffChunk, sizeof(riffChunk));
+
+			u8 junk[STREAM_JUNK_SIZE] = {};
+			chunk.id_ = JUNK_ID;
+			chunk.size_ = sizeof(junk);
+			file.Write(&chunk, sizeof(chunk));
+			file.Write(junk, sizeof(junk));
+
+			SetupFmtChunk(fmtChunk, format, numChannels, sampleRate);
+			chunk.id_ = FmtChunk::ID;
+			chunk.size_ = sizeof(FmtChunk);
+			file.Write(&chunk, sizeof(chunk));
+			file.Write(&fmtChunk, sizeof(fmtChunk));
+
+			chunk.id_ = DataChunk::ID;
+			chunk.size_ = STREAM_UNKNOWN_SIZE;
+			file.Write(&chunk, sizeof(chunk));
+			return file.Tell() - sizeof(chunk.size_);
+		}
+
+		/**
+		 * Patch sizes in a header written by WriteStreamHeader, once all sample data is written.
+		 * Streams over 4GB become RF64, with the reserved JUNK chunk turned into a ds64 chunk.
+		 */
+		void FinalizeStream(Core::File& file, i64 dataSizeOffset, i64 numBytes, i64 numFrames)
+		{
+			const i64 endOffset = dataSizeOffset + sizeof(u32) + numBytes;
+			const i64 riffSize = endOffset - (i64)sizeof(Chunk);
+			if(riffSize < (i64)RF64_SIZE)
+			{
+				const u32 riffSize32 = (u32)riffSize;
+				const u32 dataSize32 = (u32)numBytes;
+				file.Seek(sizeof(u32));
+				file.Write(&riffSize32, sizeof(riffSize32));
+				file.Seek(dataSizeOffset);
+				file.Write(&dataSize32, sizeof(dataSize32));
+			}
+			else
+			{
+				Chunk chunk;
+				chunk.id_ = RF64_ID;
+				chunk.size_ = RF64_SIZE;
+				file.Seek(0);
+				file.Write(&chunk, sizeof(chunk));
+
+				const u64 riffSize64 = (u64)riffSize;
+				const u64 dataSize64 = (u64)numBytes;
+				const u64 sampleCount = (u64)numFrames;
+				const u32 tableLength = 0;
+				chunk.id_ = DS64Chunk::ID;
+				chunk.size_ = DS64Chunk::SIZE;
+				file.Seek(STREAM_JUNK_OFFSET);
+				file.Write(&chunk, sizeof(chunk));
+				file.Write(&riffSize64, sizeof(riffSize64));
+				file.Write(&dataSize64, sizeof(dataSize64));
+				file.Write(&sampleCount, sizeof(sampleCount));
+				file.Write(&tableLength, sizeof(tableLength));
+
+				const u32 dataSize32 = RF64_SIZE;
+				file.Seek(dataSizeOffset);
+				file.Write(&dataSize32, sizeof(dataSize32));
+			}
+			file.Seek(endOffset);
+		}
+
 		void Save(Core::File& file, const Data& data)
 		{
+			// Too big for RIFF, write as a stream which is upgraded to RF64 once complete.
+			const i64 riffSize = sizeof(RIFFChunk) + sizeof(Chunk) + sizeof(FmtChunk) +
+				sizeof(Chunk) + sizeof(FACTChunk) + sizeof(Chunk) + data.numBytes_;
+			if(riffSize >= (i64)RF64_SIZE)
+			{
+				const i64 dataSizeOffset = WriteStreamHeader(file, data.format_, data.numChannels_, data.sampleRate_);
+				file.Write(data.rawData_, data.numBytes_);
+				FinalizeStream(file, dataSizeOffset, data.numBytes_, data.numSamples_);
+				return;
+			}
+
 			Chunk chunk;
 			RIFFChunk riffChunk;
 			FmtChunk fmtChunk;
@@ -162,33 +369,14 @@ namespace Sound
 
 			// Write out header chunk.
 			chunk.id_ = RIFFChunk::ID;
-			chunk.size_ = sizeof(RIFFChunk) + 
-				sizeof(Chunk) + sizeof(FmtChunk) + 
-				sizeof(Chunk) + sizeof(FACTChunk) +
-				sizeof(Chunk) + data.numBytes_;
+			chunk.size_ = (u32)riffSize;
 
 			riffChunk.format_ = WAVE_ID;
 			file.Write(&chunk, sizeof(chunk));
 			file.Write(&riffChunk, sizeof(riffChunk));
 
 			// Setup format chunk.
-			switch(data.format_)
-			{
-			case Format::S16:
-				fmtChunk.audioFormat_ = 1;
-				fmtChunk.bitsPerSample_ = 16;
-				fmtChunk.blockAlign_ = 2;
-				break;
-			case Format::F32:
-				fmtChunk.audioFormat_ = 3;
-				fmtChunk.bitsPerSample_ = 32;
-				fmtChunk.blockAlign_ = 4;
-				break;
-			}
-
-			fmtChunk.numChannels_ = (u16)data.numChannels_;
-			fmtChunk.sampleRate_ = data.sampleRate_;
-			fmtChunk.byteRate_ = (fmtChunk.numChannels_ * fmtChunk.bitsPerSample_ * fmtChunk.sampleRate_) / 8;
+			SetupFmtChunk(fmtChunk, data.format_, data.numChannels_, data.sampleRate_);
 
 			chunk.id_ = FmtChunk::ID;
 			chunk.size_ = sizeof(FmtChunk);
@@ -196,7 +384,7 @@ namespace Sound
 			file.Write(&fmtChunk, sizeof(fmtChunk));
 
 			// Setup fact chunk.
-			factChunk.fileSize_ = data.numSamples_;
+			factChunk.fileSize_ = (u32)data.numSamples_;
 
 			chunk.id_ = FACTChunk::ID;
 			chunk.size_ = sizeof(FACTChunk);
@@ -205,7 +393,7 @@ namespace Sound
 
 			// Write data chunk.
 			chunk.id_ = DataChunk::ID;
-			chunk.size_ = data.numBytes_;
+			chunk.size_ = (u32)data.numBytes_;
 			file.Write(&chunk, sizeof(chunk));
 			file.Write(data.rawData_, data.numBytes_);
 
@@ -217,46 +405,260 @@ namespace Sound
 	{
 		static const u32 TAG = 'SggO';
 
-		Data Load(Core::File& file)
+		/// Initial size of compressed data buffer. Grown if a single page doesn't fit.
+		static const i32 BUFFER_SIZE = 16 * 1024;
+		/// Amount of the file end to scan for the last page's granule position.
+		static const i32 LENGTH_SCAN_SIZE = 64 * 1024;
+
+		/**
+		 * Incremental decoder, feeding the stb_vorbis pushdata API from a file.
+		 * Only the current page & decoded frame are held in memory.
+		 */
+		struct Decoder
 		{
-			Data data;
-			Core::Vector<u8> fileData;
-			fileData.resize((i32)file.Size());
-			file.Read(fileData.data(), fileData.size());
+			Decoder() = default;
+			Decoder(const Decoder&) = delete;
+			Decoder& operator=(const Decoder&) = delete;
+			~Decoder() { Close(); }
+
+			Core::File* file_ = nullptr;
+			stb_vorbis* vorbis_ = nullptr;
+			/// Compressed data read from file, but not yet consumed by the decoder.
+			Core::Vector<u8> buffer_;
+			i32 bufferSize_ = 0;
+			bool eof_ = false;
+			/// Offset of the first audio page, after headers.
+			i64 dataOffset_ = 0;
+
+			/// Current decoded frame, and how much of it has been read.
+			f32** outputs_ = nullptr;
+			i32 numOutputs_ = 0;
+			i32 outputOffset_ = 0;
+			/// Frame at the read position.
+			i64 position_ = 0;
+
+			i32 numChannels_ = 0;
+			i32 sampleRate_ = 0;
+			i64 numFrames_ = 0;
+
+			/// Top up buffer from file, growing it if full.
+			bool FillBuffer()
+			{
+				if(eof_)
+					return false;
+				if(bufferSize_ == buffer_.size())
+					buffer_.resize(Core::Max(buffer_.size() * 2, BUFFER_SIZE));
+				const i32 numRead = (i32)file_->Read(buffer_.data() + bufferSize_, buffer_.size() - bufferSize_);
+				if(numRead <= 0)
+				{
+					eof_ = true;
+					return false;
+				}
+				bufferSize_ += numRead;
+				return true;
+			}
 
-			int error = 0;
-			stb_vorbis* vorbis = stb_vorbis_open_memory(fileData.data(), fileData.size(), &error, nullptr);
-			if(vorbis)
+			void ConsumeBuffer(i32 numBytes)
 			{
-				stb_vorbis_info vorbisInfo = stb_vorbis_get_info(vorbis);
+				bufferSize_ -= numBytes;
+				memmove(buffer_.data(), buffer_.data() + numBytes, bufferSize_);
+			}
 
-				data.numChannels_ = vorbisInfo.channels;
-				data.sampleRate_ = vorbisInfo.sample_rate;
-				data.numSamples_ = stb_vorbis_stream_length_in_samples(vorbis);
-				data.format_ = Format::F32;
-				data.numBytes_ = sizeof(f32) * data.numSamples_ * data.numChannels_;
-				data.rawData_ = new u8[data.numBytes_];
+			/// Total frames are the granule position of the last page.
+			i64 ScanLength()
+			{
+				const i64 fileSize = file_->Size();
+				const i32 scanSize = (i32)Core::Min(fileSize, (i64)LENGTH_SCAN_SIZE);
+				Core::Vector<u8> scanData;
+				scanData.resize(scanSize);
+				file_->Seek(fileSize - scanSize);
+				file_->Read(scanData.data(), scanSize);
+				for(i32 idx = scanSize - 27; idx >= 0; --idx)
+				{
+					const u8* page = scanData.data() + idx;
+					if(page[0] == 'O' && page[1] == 'g' && page[2] == 'g' && page[3] == 'S')
+					{
+						i64 granule = 0;
+						memcpy(&granule, page + 6, sizeof(granule));
+						if(granule >= 0)
+							return granule;
+					}
+				}
+				return 0;
+			}
+
+			bool Open(Core::File& file)
+			{
+				Close();
+				file_ = &file;
+				eof_ = false;
+				bufferSize_ = 0;
+
+				numFrames_ = ScanLength();
+				file.Seek(0);
+
+				// Feed headers until the decoder has enough to start.
+				while(FillBuffer() || bufferSize_ > 0)
+				{
+					int used = 0;
+					int error = 0;
+					vorbis_ = stb_vorbis_open_pushdata(buffer_.data(), bufferSize_, &used, &error, nullptr);
+					if(vorbis_)
+					{
+						ConsumeBuffer(used);
+						break;
+					}
+					if(error != VORBIS_need_more_data || eof_)
+						break;
+				}
+
+				if(!vorbis_)
+					return false;
+
+				stb_vorbis_info vorbisInfo = stb_vorbis_get_info(vorbis_);
+				numChannels_ = vorbisInfo.channels;
+				sampleRate_ = vorbisInfo.sample_rate;
+				dataOffset_ = file.Tell() - bufferSize_;
+				position_ = 0;
+				numOutputs_ = 0;
+				outputOffset_ = 0;
+				return true;
+			}
+
+			void Close()
+			{
+				if(vorbis_)
+					stb_vorbis_close(vorbis_);
+				vorbis_ = nullptr;
+			}
+
+			/// Decode next frame into outputs_.
+			bool DecodeFrame()
+			{
+				for(;;)
+				{
+					if(bufferSize_ < buffer_.size())
+						FillBuffer();
+
+					int channels = 0;
+					int samples = 0;
+					float** outputs = nullptr;
+					const int used = stb_vorbis_decode_frame_pushdata(vorbis_, buffer_.data(), bufferSize_, &channels, &outputs, &samples);
+					ConsumeBuffer(used);
+					if(samples > 0)
+					{
+						outputs_ = outputs;
+						numOutputs_ = samples;
+						outputOffset_ = 0;
+						return true;
+					}
+
+					// Needs more data than we have. Grow if a whole page doesn't fit.
+					if(used == 0 && !FillBuffer())
+						return false;
+				}
+			}
+
+			i32 Read(f32* data, i32 numFrames)
+			{
+				i32 numRead = 0;
+				while(numRead < numFrames)
+				{
+					if(outputOffset_ == numOutputs_ && !DecodeFrame())
+						break;
+
+					const i32 numCopy = Core::Min(numFrames - numRead, numOutputs_ - outputOffset_);
+					for(i32 sample = 0; sample < numCopy; ++sample)
+						for(i32 ch = 0; ch < numChannels_; ++ch)
+							*data++ = outputs_[ch][outputOffset_ + sample];
+
+					outputOffset_ += numCopy;
+					numRead += numCopy;
+				}
+				position_ += numRead;
+				return numRead;
+			}
 
-				f32* outData = reinterpret_cast<f32*>(data.rawData_);
+			bool Seek(i64 frame)
+			{
+				if(!vorbis_ || frame < 0 || frame > numFrames_)
+					return false;
 
-				for(;;)	
+				// Guess where the frame is by bitrate, backing off until we land on a page before it.
+				const i64 fileSize = file_->Size();
+				i64 offset = dataOffset_ + (i64)((f64)(fileSize - dataOffset_) * ((f64)frame / (f64)Core::Max(numFrames_, (i64)1))) - BUFFER_SIZE;
+				for(;;)
 				{
-					float **outputs = nullptr;
-					int n = stb_vorbis_get_frame_float(vorbis, nullptr, &outputs);
-					if (n == 0)
+					if(offset <= dataOffset_)
 					{
+						// Restart from the first page.
+						if(!Open(*file_))
+							return false;
 						break;
 					}
 
-					for(i32 sample = 0; sample < n; ++sample)
+					file_->Seek(offset);
+					stb_vorbis_flush_pushdata(vorbis_);
+					bufferSize_ = 0;
+					eof_ = false;
+					outputOffset_ = numOutputs_ = 0;
+
+					// Decode until the page granule tells us where we are.
+					// stb_vorbis only keeps its low 32 bits, so take the wrap nearest the bitrate estimate.
+					const i64 estimate = (i64)((f64)numFrames_ * ((f64)(offset - dataOffset_) / (f64)Core::Max(fileSize - dataOffset_, (i64)1)));
+					i64 sampleOffset = -1;
+					while(sampleOffset < 0 && DecodeFrame())
 					{
-						for(i32 ch = 0; ch < data.numChannels_; ++ch)
+						const int stbOffset = stb_vorbis_get_sample_offset(vorbis_);
+						if(stbOffset != -1)
 						{
-							*outData++ = outputs[ch][sample];
+							sampleOffset = (i64)(u32)stbOffset;
+							sampleOffset += ((estimate - sampleOffset + (1LL << 31)) >> 32) << 32;
+							if(sampleOffset < 0)
+								sampleOffset += 1LL << 32;
 						}
 					}
+
+					const i64 framePosition = sampleOffset - numOutputs_;
+					if(sampleOffset >= 0 && framePosition <= frame)
+					{
+						position_ = framePosition;
+						break;
+					}
+					offset = dataOffset_ + (offset - dataOffset_) / 2;
+				}
+
+				// Decode forward to the exact frame.
+				while(position_ + (numOutputs_ - outputOffset_) <= frame)
+				{
+					position_ += numOutputs_ - outputOffset_;
+					outputOffset_ = numOutputs_;
+					if(!DecodeFrame())
+						return frame == position_;
 				}
-				stb_vorbis_close(vorbis);
+				outputOffset_ += (i32)(frame - position_);
+				position_ = frame;
+				return true;
+			}
+		};
+
+		Data Load(Core::File& file)
+		{
+			Data data;
+			Decoder decoder;
+			if(decoder.Open(file))
+			{
+				data.numChannels_ = decoder.numChannels_;
+				data.sampleRate_ = decoder.sampleRate_;
+				data.format_ = Format::F32;
+				data.numBytes_ = sizeof(f32) * decoder.numFrames_ * data.numChannels_;
+				data.rawData_ = new u8[data.numBytes_];
+				f32* samples = reinterpret_cast<f32*>(data.rawData_);
+				i32 numRead = 0;
+				while(data.numSamples_ < decoder.numFrames_ &&
+					(numRead = decoder.Read(samples + data.numSamples_ * data.numChannels_, (i32)Core::Min(decoder.numFrames_ - data.numSamples_, (i64)(1 << 30)))) > 0)
+					data.numSamples_ += numRead;
+				data.numBytes_ = sizeof(f32) * data.numSamples_ * data.numChannels_;
 			}
 			return std::move(data);
 		}
@@ -295,13 +697,364 @@ namespace Sound
 	}
 
 
+	/// Samples converted per kernel call.
+	static const i64 CONVERT_BLOCK_SIZE = 1 << 24;
+
+	i32 GetSampleSize(Format format)
+	{
+		switch(format)
+		{
+		case Format::S16: return sizeof(i16);
+		case Format::S24: return 3;
+		case Format::S32: return sizeof(i32);
+		case Format::F32: return sizeof(f32);
+		default: return 0;
+		}
+	}
+
+	void ConvertToF32(Format format, const void* in, f32* out, i64 numSamples)
+	{
+		// Kernels take 32 bit counts.
+		if(numSamples > CONVERT_BLOCK_SIZE)
+		{
+			const i32 sampleSize = GetSampleSize(format);
+			for(i64 offset = 0; offset < numSamples; offset += CONVERT_BLOCK_SIZE)
+				ConvertToF32(format, static_cast<const u8*>(in) + offset * sampleSize, out + offset, Core::Min(numSamples - offset, CONVERT_BLOCK_SIZE));
+			return;
+		}
+
+		const i32 num = (i32)numSamples;
+		switch(format)
+		{
+		case Format::S16:
+			ispc::convert_s16_to_f32(static_cast<const i16*>(in), out, num);
+			break;
+		case Format::S24:
+			ispc::convert_s24_to_f32(static_cast<const u8*>(in), out, num);
+			break;
+		case Format::S32:
+			ispc::convert_s32_to_f32(static_cast<const i32*>(in), out, num);
+			break;
+		case Format::F32:
+			if(in != out)
+				memcpy(out, in, sizeof(f32) * num);
+			break;
+		default:
+			memset(out, 0, sizeof(f32) * num);
+			break;
+		}
+	}
+
+	void ConvertFromF32(Format format, const f32* in, void* out, i64 numSamples)
+	{
+		if(numSamples > CONVERT_BLOCK_SIZE)
+		{
+			const i32 sampleSize = GetSampleSize(format);
+			for(i64 offset = 0; offset < numSamples; offset += CONVERT_BLOCK_SIZE)
+				ConvertFromF32(format, in + offset, static_cast<u8*>(out) + offset * sampleSize, Core::Min(numSamples - offset, CONVERT_BLOCK_SIZE));
+			return;
+		}
+
+		const i32 num = (i32)numSamples;
+		switch(format)
+		{
+		case Format::S16:
+			ispc::convert_f32_to_s16(in, static_cast<i16*>(out), num);
+			break;
+		case Format::S24:
+			ispc::convert_f32_to_s24(in, static_cast<u8*>(out), num);
+			break;
+		case Format::S32:
+			ispc::convert_f32_to_s32(in, static_cast<i32*>(out), num);
+			break;
+		case Format::F32:
+			if(in != out)
+				memcpy(out, in, sizeof(f32) * num);
+			break;
+		default:
+			break;
+		}
+	}
+
+	void Interleave(const f32* const* in, i32 numChannels, i32 numFrames, f32* out)
+	{
+		if(numChannels == 1)
+			memcpy(out, in[0], sizeof(f32) * numFrames);
+		else
+			ispc::convert_interleave(const_cast<const f32**>(in), numChannels, numFrames, out);
+	}
+
+	void Deinterleave(const f32* in, i32 numChannels, i32 numFrames, f32* const* out)
+	{
+		if(numChannels == 1)
+			memcpy(out[0], in, sizeof(f32) * numFrames);
+		else
+			ispc::convert_deinterleave(in, numChannels, numFrames, const_cast<f32**>(out));
+	}
+
+	Data Convert(const Data& data, Format format)
+	{
+		Data outData;
+		if(!data || GetSampleSize(format) == 0)
+			return outData;
+
+		outData.numChannels_ = data.numChannels_;
+		outData.sampleRate_ = data.sampleRate_;
+		outData.numSamples_ = data.numSamples_;
+		outData.format_ = format;
+		const i64 numValues = data.numSamples_ * data.numChannels_;
+		outData.numBytes_ = numValues * GetSampleSize(format);
+		outData.rawData_ = new u8[outData.numBytes_];
+		if(format == Format::F32)
+		{
+			ConvertToF32(data.format_, data.rawData_, reinterpret_cast<f32*>(outData.rawData_), numValues);
+		}
+		else if(data.format_ == Format::F32)
+		{
+			ConvertFromF32(format, reinterpret_cast<const f32*>(data.rawData_), outData.rawData_, numValues);
+		}
+		else
+		{
+			// Go via f32 in blocks to bound temporary memory.
+			const i32 BLOCK_SIZE = 4096;
+			f32 block[BLOCK_SIZE];
+			const i32 inSampleSize = GetSampleSize(data.format_);
+			const i32 outSampleSize = GetSampleSize(format);
+			for(i64 offset = 0; offset < numValues; offset += BLOCK_SIZE)
+			{
+				const i32 num = (i32)Core::Min((i64)BLOCK_SIZE, numValues - offset);
+				ConvertToF32(data.format_, data.rawData_ + offset * inSampleSize, block, num);
+				ConvertFromF32(format, block, outData.rawData_ + offset * outSampleSize, num);
+			}
+		}
+		return outData;
+	}
+
+	Data Resample(const Data& data, i32 sampleRate, ResamplerQuality quality)
+	{
+		if(!data || sampleRate <= 0)
+			return Data();
+		if(data.format_ != Format::F32)
+			return Resample(Convert(data, Format::F32), sampleRate, quality);
+
+		Resampler resampler(data.numChannels_, data.sampleRate_, sampleRate, quality);
+		Data outData;
+		outData.numChannels_ = data.numChannels_;
+		outData.sampleRate_ = sampleRate;
+		outData.format_ = Format::F32;
+		outData.numSamples_ = resampler.GetNumOutputFrames(data.numSamples_);
+		outData.numBytes_ = sizeof(f32) * outData.numSamples_ * outData.numChannels_;
+		outData.rawData_ = new u8[outData.numBytes_];
+
+		// Feed input in blocks the resampler can count, then silence to flush out the filter's tail.
+		const f32* in = reinterpret_cast<const f32*>(data.rawData_);
+		f32* out = reinterpret_cast<f32*>(outData.rawData_);
+		const i64 blockFrames = CONVERT_BLOCK_SIZE;
+		i64 numConsumed = 0;
+		i64 numProduced = 0;
+		while(numConsumed < data.numSamples_ && numProduced < outData.numSamples_)
+		{
+			i32 numBlockConsumed = 0;
+			const i32 numBlockProduced = resampler.Process(in + numConsumed * data.numChannels_, (i32)Core::Min(data.numSamples_ - numConsumed, blockFrames), numBlockConsumed,
+				out + numProduced * outData.numChannels_, (i32)Core::Min(outData.numSamples_ - numProduced, blockFrames));
+			if(numBlockConsumed == 0 && numBlockProduced == 0)
+				break;
+			numConsumed += numBlockConsumed;
+			numProduced += numBlockProduced;
+		}
+		while(numProduced < outData.numSamples_)
+		{
+			i32 numFlushed = 0;
+			const i32 numRemaining = (i32)Core::Min(outData.numSamples_ - numProduced, blockFrames);
+			numProduced += resampler.Process(nullptr, numRemaining, numFlushed,
+				out + numProduced * outData.numChannels_, numRemaining);
+		}
+		return outData;
+	}
+
+	struct DataViewImpl
+	{
+		/// Format, channels & sample rate. Data chunk size may be clamped to the file size.
+		Data info_;
+		i64 numBytes_ = 0;
+		const u8* samples_ = nullptr;
+
+		/// Mapping of the whole file, if mapped.
+		void* mapping_ = nullptr;
+		i64 mappingSize_ = 0;
+#if defined(_WIN32)
+		HANDLE fileHandle_ = INVALID_HANDLE_VALUE;
+		HANDLE mappingHandle_ = nullptr;
+#endif
+		/// Copy of the data chunk, if not mapped.
+		Core::Vector<u8> copy_;
+
+		bool Map(const char* fileName)
+		{
+#if defined(_WIN32)
+			fileHandle_ = ::CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+			if(fileHandle_ == INVALID_HANDLE_VALUE)
+				return false;
+			LARGE_INTEGER fileSize;
+			if(!::GetFileSizeEx(fileHandle_, &fileSize))
+				return false;
+			mappingHandle_ = ::CreateFileMappingA(fileHandle_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if(!mappingHandle_)
+				return false;
+			mapping_ = ::MapViewOfFile(mappingHandle_, FILE_MAP_READ, 0, 0, 0);
+			mappingSize_ = fileSize.QuadPart;
+#else
+			const int fd = ::open(fileName, O_RDONLY);
+			if(fd < 0)
+				return false;
+			struct stat fileStat;
+			if(::fstat(fd, &fileStat) == 0 && fileStat.st_size > 0)
+			{
+				mapping_ = ::mmap(nullptr, (size_t)fileStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+				if(mapping_ == MAP_FAILED)
+					mapping_ = nullptr;
+				else
+					mappingSize_ = fileStat.st_size;
+			}
+			// Mapping keeps its own reference to the file.
+			::close(fd);
+#endif
+			return mapping_ != nullptr;
+		}
+
+		void Unmap()
+		{
+#if defined(_WIN32)
+			if(mapping_)
+				::UnmapViewOfFile(mapping_);
+			if(mappingHandle_)
+				::CloseHandle(mappingHandle_);
+			if(fileHandle_ != INVALID_HANDLE_VALUE)
+				::CloseHandle(fileHandle_);
+			mappingHandle_ = nullptr;
+			fileHandle_ = INVALID_HANDLE_VALUE;
+#else
+			if(mapping_)
+				::munmap(mapping_, (size_t)mappingSize_);
+#endif
+			mapping_ = nullptr;
+			mappingSize_ = 0;
+		}
+
+		~DataViewImpl()
+		{
+			Unmap();
+		}
+	};
+
+	DataView::DataView(const char* fileName)
+	{
+		impl_ = new DataViewImpl();
+
+		// Parse chunks to find format & where samples start.
+		i64 dataOffset = 0;
+		i64 fileSize = 0;
+		{
+			auto file = Core::File(fileName, Core::FileFlags::READ);
+			if(!file || !Wav::ReadHeader(file))
+				return;
+			Wav::ReadChunks(file, impl_->info_, &dataOffset);
+			fileSize = file.Size();
+		}
+
+		if(impl_->info_.format_ == Format::UNKNOWN || dataOffset == 0)
+			return;
+
+		// Recordings which weren't finalized may have a data chunk size past the end of the file.
+		impl_->numBytes_ = Core::Min((i64)impl_->info_.numBytes_, fileSize - dataOffset);
+		const i64 sampleSize = GetSampleSize(impl_->info_.format_);
+		if(impl_->Map(fileName) && (dataOffset % sampleSize) == 0)
+		{
+			impl_->samples_ = static_cast<const u8*>(impl_->mapping_) + dataOffset;
+		}
+		else if(impl_->numBytes_ <= 0x7fffffff)
+		{
+			impl_->Unmap();
+			auto file = Core::File(fileName, Core::FileFlags::READ);
+			impl_->copy_.resize((i32)impl_->numBytes_);
+			file.Seek(dataOffset);
+			impl_->numBytes_ = file.Read(impl_->copy_.data(), impl_->numBytes_);
+			impl_->samples_ = impl_->copy_.data();
+		}
+	}
+
+	DataView::~DataView()
+	{
+		delete impl_;
+	}
+
+	DataView::DataView(DataView&& other)
+	{
+		swap(other);
+	}
+
+	DataView& DataView::operator=(DataView&& other)
+	{
+		swap(other);
+		return *this;
+	}
+
+	void DataView::swap(DataView& other)
+	{
+		using std::swap;
+		swap(impl_, other.impl_);
+	}
+
+	DataView::operator bool() const
+	{
+		return impl_ && impl_->samples_ != nullptr;
+	}
+
+	const void* DataView::GetSamples() const
+	{
+		return impl_ ? impl_->samples_ : nullptr;
+	}
+
+	i64 DataView::GetNumBytes() const
+	{
+		return impl_ ? impl_->numBytes_ : 0;
+	}
+
+	i64 DataView::GetNumFrames() const
+	{
+		if(!*this || impl_->info_.numChannels_ == 0)
+			return 0;
+		const i64 sampleSize = GetSampleSize(impl_->info_.format_);
+		return impl_->numBytes_ / (sampleSize * impl_->info_.numChannels_);
+	}
+
+	i32 DataView::GetNumChannels() const
+	{
+		return impl_ ? impl_->info_.numChannels_ : 0;
+	}
+
+	i32 DataView::GetSampleRate() const
+	{
+		return impl_ ? impl_->info_.sampleRate_ : 0;
+	}
+
+	Format DataView::GetFormat() const
+	{
+		return impl_ ? impl_->info_.format_ : Format::UNKNOWN;
+	}
+
+	bool DataView::IsMapped() const
+	{
+		return impl_ && impl_->mapping_ != nullptr;
+	}
+
 	Data Load(Core::File& file)
 	{
 		u32 tag = 0;
 		file.Read(&tag, sizeof(tag));
 		file.Seek(0);
 
-		if(tag == Wav::TAG)
+		if(tag == Wav::TAG || tag == Wav::RF64_ID)
 		{
 			return Wav::Load(file);
 		}
@@ -309,6 +1062,10 @@ namespace Sound
 		{
 			return Ogg::Load(file);
 		}
+		else if(tag == Lossless::TAG)
+		{
+			return Lossless::Load(file);
+		}
 
 		return Data();
 	}
@@ -318,160 +1075,412 @@ namespace Sound
 		Wav::Save(file, data);
 	}
 
-	void Save(Core::File& rawFile, Core::File& outFile, Format format, i32 numChannels, i32 sampleRate)
+	void Save(Core::File& rawFile, Core::File& outFile, Format format, i32 numChannels, i32 sampleRate, Format saveFormat, i32 saveSampleRate)
 	{
 		Sound::Data data;
-		data.numChannels_ = 1;
-		data.sampleRate_ = 48000;
-		data.format_ = Sound::Format::F32;
-		data.numBytes_ = (u32)rawFile.Size();
+		data.numChannels_ = numChannels;
+		data.sampleRate_ = sampleRate;
+		data.format_ = format;
+		data.numBytes_ = rawFile.Size();
 		data.rawData_ = new u8[data.numBytes_];
 		rawFile.Read(data.rawData_, data.numBytes_);
-		data.numSamples_ = data.numBytes_ / (data.numChannels_ * sizeof(f32));
+		data.numSamples_ = data.numBytes_ / (data.numChannels_ * GetSampleSize(format));
+		if(saveSampleRate > 0 && saveSampleRate != sampleRate)
+			data = Resample(data, saveSampleRate);
+		if(saveFormat != Format::UNKNOWN && saveFormat != data.format_)
+			data = Convert(data, saveFormat);
 		Sound::Save(outFile, data);
 	}
 
-	void SaveSoundAsync(const char* rawFilename, const char* outFilename, Format format, i32 numChannels, i32 sampleRate)
+	i64 BeginSaveStream(Core::File& file, Format format, i32 numChannels, i32 sampleRate)
+	{
+		return Wav::WriteStreamHeader(file, format, numChannels, sampleRate);
+	}
+
+	void EndSaveStream(Core::File& file, i64 streamOffset, i64 numBytes, i64 numFrames)
+	{
+		Wav::FinalizeStream(file, streamOffset, numBytes, numFrames);
+	}
+
+	struct OutputStreamImpl
 	{
-		struct Params
+		/// Current ID.
+		u32 soundBufferID_ = 0;
+		/// Sample rate to save with.
+		i32 sampleRate_ = 0;
+		i32 numChannels_ = 0;
+		/// Write each channel to its own file.
+		bool perTrack_ = false;
+		bool compressed_ = false;
+		/// Frames per channel each block can hold.
+		i32 maxFrames_ = 0;
+		/// Current number of frames in block, including frames being dropped.
+		i32 numFrames_ = 0;
+		/// Number of frames in the block being written.
+		i32 numFlushFrames_ = 0;
+		/// Total frames queued to be written.
+		i64 totalFrames_ = 0;
+
+		/// Non-interleaved frames, maxFrames_ per channel.
+		struct Block
 		{
-			Core::Array<char, Core::MAX_PATH_LENGTH> inFilename_;
-			Core::Array<char, Core::MAX_PATH_LENGTH> outFilename_;
-			Sound::Format format_;
-			i32 numChannels_;
-			i32 sampleRate_;
+			Core::Vector<f32> samples_;
+			i32 numFrames_ = 0;
 		};
 
-		auto* params = new Params;
-		strcpy_s(params->inFilename_.data(), params->inFilename_.size(), rawFilename);
-		strcpy_s(params->outFilename_.data(), params->outFilename_.size(), outFilename);
-		params->format_ = format;
-		params->numChannels_ = numChannels;
-		params->sampleRate_ = sampleRate;
-
-		Job::JobDesc jobDesc;
-		jobDesc.func_ = [](i32 param, void* data) {
-			Params* params = static_cast<Params*>(data);
-				
-			auto inFile = Core::File(params->inFilename_.data(), Core::FileFlags::READ);
-			if(inFile)
-			{
-				if(Core::FileExists(params->outFilename_.data()))
+		/// Pool of blocks, passed from the audio thread to the writer through fullBlocks_ & back through freeBlocks_.
+		Core::Vector<Block> blocks_;
+		RingBuffer<Block*> freeBlocks_;
+		RingBuffer<Block*> fullBlocks_;
+		/// Block being filled, or nullptr while dropping frames as the pool is exhausted.
+		Block* block_ = nullptr;
+		/// Blocks worth of frames dropped because the writer fell behind.
+		volatile i32 numDroppedBlocks_ = 0;
+		/// 1 while something is writing blocks, either the writer job or the destructor.
+		volatile i32 writing_ = 0;
+		/// Set once recording starts. Until then the stream has no ID & no files, so unused streams leave nothing behind.
+		bool started_ = false;
+		bool filesOpen_ = false;
+		Job::JobDesc writerJob_;
+		/// Scratch for interleaving on the flush job.
+		Core::Vector<f32> interleaveBuffer_;
+		Core::Vector<const f32*> flushChannels_;
+		/// Files samples are flushed straight into. One per channel if perTrack_.
+		Core::Vector<Core::File> flushFiles_;
+		/// Offset of each wav file's data chunk size, patched once complete.
+		Core::Vector<i64> dataSizeOffsets_;
+		/// Lossless encoder per file, if compressing.
+		Core::Vector<Lossless::Encoder*> encoders_;
+		/// Peaks per file, saved as a sidecar once complete.
+		Core::Vector<PeakPyramid*> peaks_;
+		/// Flush job per file, so files are written in parallel.
+		Core::Vector<Job::JobDesc> flushJobs_;
+		/// Flush job counter, when writing files in parallel.
+		Job::Counter* flushCounter_ = nullptr; 
+		/// Frames from before the recording started, written with the first block then released.
+		PreRollBuffer* preRoll_ = nullptr;
+		Core::Vector<const f32*> preRollChannels_;
+		/// Files still to write the pre-roll, the last one releases it.
+		volatile i32 preRollFiles_ = 0;
+
+		void FlushFile(i32 fileIdx)
+		{
+			const i32 firstChannel = perTrack_ ? fileIdx : 0;
+			const i32 numChannels = perTrack_ ? 1 : numChannels_;
+			if(preRoll_)
+			{
+				// In chunks, as the interleave buffer only holds maxFrames_.
+				const f32** channels = preRollChannels_.data() + firstChannel;
+				for(i32 frame = 0; frame < preRoll_->GetNumFrames(); )
 				{
-					Core::FileRemove(params->outFilename_.data());
+					i32 numFrames = maxFrames_;
+					for(i32 ch = 0; ch < numChannels; ++ch)
+						channels[ch] = preRoll_->GetFrames(firstChannel + ch, frame, numFrames);
+					WriteFrames(fileIdx, channels, numFrames);
+					frame += numFrames;
 				}
 
-				auto outFile = Core::File(params->outFilename_.data(), Core::FileFlags::CREATE | Core::FileFlags::WRITE);
-				Sound::Save(inFile, outFile, params->format_, params->numChannels_, params->sampleRate_);
+				if(Core::AtomicDec(&preRollFiles_) == 0)
+					preRoll_->Release();
+			}
 
-				std::swap(inFile, Core::File());
-				if(Core::FileExists(params->inFilename_.data()))
+			WriteFrames(fileIdx, flushChannels_.data() + firstChannel, numFlushFrames_);
+		}
+
+		/// Create files & write headers. Done by the writer, so nothing touches disk until recording starts.
+		void OpenFiles()
+		{
+			if(filesOpen_)
+				return;
+			filesOpen_ = true;
+
+			// Never overwrite an existing recording, skip to the next free ID instead.
+			RT_CHECK(FILE_IO);
+			for(bool isFree = false; !isFree; )
+			{
+				isFree = true;
+				for(i32 idx = 0; idx < flushFiles_.size() && isFree; ++idx)
 				{
-					Core::FileRemove(params->inFilename_.data());
+					Core::Array<char, Core::MAX_PATH_LENGTH> fileName;
+					OutputStream::GetFileName(soundBufferID_, perTrack_ ? idx : -1, compressed_, fileName.data(), fileName.size());
+					isFree = !Core::FileExists(fileName.data());
 				}
+				if(!isFree)
+					soundBufferID_ = Core::AtomicInc(&OutputStream::SoundBufferID);
 			}
 
-			delete params;
-		};
-		jobDesc.data_ = params;
-		jobDesc.name_ = "Save file to wav";
-		Job::Manager::RunJobs(&jobDesc, 1);
-	}
+			const i32 fileChannels = perTrack_ ? 1 : numChannels_;
+			for(i32 idx = 0; idx < flushFiles_.size(); ++idx)
+			{
+				Core::Array<char, Core::MAX_PATH_LENGTH> fileName;
+				OutputStream::GetFileName(soundBufferID_, perTrack_ ? idx : -1, compressed_, fileName.data(), fileName.size());
+				auto& file = flushFiles_[idx];
+				file = Core::File(fileName.data(), Core::FileFlags::CREATE | Core::FileFlags::WRITE);
+				if(compressed_)
+					encoders_[idx] = new Lossless::Encoder(file, fileChannels, sampleRate_);
+				else if(file)
+					dataSizeOffsets_[idx] = Wav::WriteStreamHeader(file, Format::F32, fileChannels, sampleRate_);
+				peaks_[idx] = new PeakPyramid(fileChannels, sampleRate_);
+			}
+		}
 
-	struct OutputStreamImpl
-	{
-		/// Current ID.
-		u32 soundBufferID_ = 0;
-		/// Sample rate to save with.
-		i32 sampleRate_ = 0;
-		/// Current size of buffer.
-		i32 size_ = 0;
-		/// Total size of buffer (inc. flushed)
-		i32 totalSize_ = 0;
-		/// Buffer we're writing into currently.
-		Core::Vector<u8> buffer_;
-		/// Buffer to flush to disk.
-		Core::Vector<u8> flushBuffer_;
-		/// File to flush out to incrementally.
-		Core::File flushFile_;
-		/// Flush file name.
-		Core::Array<char, Core::MAX_PATH_LENGTH> flushFileName_;
-		/// Save file name.
-		Core::Array<char, Core::MAX_PATH_LENGTH> saveFileName_;
-		/// Flush job counter to wait until flushing to disk has completed.
-		Job::Counter* flushCounter_ = nullptr; 
+		/// Write queued blocks until there are none left, then return them to the pool.
+		void WriteBlocks()
+		{
+			OpenFiles();
+
+			Block* block = nullptr;
+			while(fullBlocks_.Read(&block, 1) == 1)
+			{
+				numFlushFrames_ = block->numFrames_;
+				for(i32 ch = 0; ch < numChannels_; ++ch)
+					flushChannels_[ch] = block->samples_.data() + ch * maxFrames_;
+
+				// Files are independent, so per track recordings write in parallel.
+				if(flushJobs_.size() > 1)
+				{
+					Job::Manager::RunJobs(flushJobs_.data(), flushJobs_.size(), &flushCounter_);
+					Job::Manager::WaitForCounter(flushCounter_, 0);
+				}
+				else
+				{
+					FlushFile(0);
+				}
+				preRoll_ = nullptr;
+
+				freeBlocks_.Write(&block, 1);
+			}
+		}
+
+		void WriteFrames(i32 fileIdx, const f32* const* channels, i32 numFrames)
+		{
+			const i32 numChannels = perTrack_ ? 1 : numChannels_;
+			if(encoders_.size() > 0)
+			{
+				encoders_[fileIdx]->Encode(channels, numFrames);
+			}
+			else if(numChannels > 1)
+			{
+				Interleave(channels, numChannels, numFrames, interleaveBuffer_.data());
+				flushFiles_[fileIdx].Write(interleaveBuffer_.data(), sizeof(f32) * numFrames * numChannels);
+			}
+			else
+			{
+				flushFiles_[fileIdx].Write(channels[0], sizeof(f32) * numFrames);
+			}
+			peaks_[fileIdx]->Push(channels, numFrames);
+		}
 	};
 
 	volatile i32 OutputStream::SoundBufferID = 0;
 
-	OutputStream::OutputStream(i32 sampleRate)
+	OutputStream::OutputStream(i32 sampleRate, i32 numChannels, bool perTrack, bool compressed)
 	{
 		impl_ = new OutputStreamImpl();
 
-		impl_->soundBufferID_ = Core::AtomicInc(&SoundBufferID);
-		sprintf_s(impl_->flushFileName_.data(), impl_->flushFileName_.size(), "temp_audio_out_%08u.raw", impl_->soundBufferID_);
-		sprintf_s(impl_->saveFileName_.data(), impl_->saveFileName_.size(), "audio_out_%08u.wav", impl_->soundBufferID_);
 		impl_->sampleRate_ = sampleRate;
-		impl_->buffer_.resize(FLUSH_SIZE);
-		impl_->flushBuffer_.resize(FLUSH_SIZE);
-		if(Core::FileExists(impl_->flushFileName_.data()))
+		impl_->numChannels_ = numChannels;
+		impl_->perTrack_ = perTrack && numChannels > 1;
+		impl_->compressed_ = compressed;
+
+		// Buffer at least FLUSH_TIME of audio, so wide interfaces don't flush too often.
+		const i32 frameSize = sizeof(f32) * numChannels;
+		impl_->maxFrames_ = Core::Max(FLUSH_SIZE / frameSize, (i32)(sampleRate * FLUSH_TIME));
+
+		// Everything the audio thread needs is allocated up front.
+		impl_->blocks_.resize(NUM_BLOCKS);
+		impl_->freeBlocks_.Resize(NUM_BLOCKS);
+		impl_->fullBlocks_.Resize(NUM_BLOCKS);
+		for(auto& block : impl_->blocks_)
 		{
-			Core::FileRemove(impl_->flushFileName_.data());
+			block.samples_.resize(impl_->maxFrames_ * numChannels);
+			OutputStreamImpl::Block* blockPtr = &block;
+			impl_->freeBlocks_.Write(&blockPtr, 1);
+		}
+		impl_->freeBlocks_.Read(&impl_->block_, 1);
+
+		impl_->writerJob_.func_ = [](i32 param, void* data) {
+			auto* impl = static_cast<OutputStreamImpl*>(data);
+			impl->WriteBlocks();
+			// Last access, the destructor may free impl as soon as this is cleared.
+			Core::AtomicExchg(&impl->writing_, 0);
+		};
+		impl_->writerJob_.param_ = 0;
+		impl_->writerJob_.data_ = impl_;
+		impl_->writerJob_.name_ = "SoundBuffer write";
+
+		impl_->flushChannels_.resize(numChannels);
+		impl_->preRollChannels_.resize(numChannels);
+		if(!impl_->perTrack_ && !compressed && numChannels > 1)
+			impl_->interleaveBuffer_.resize(impl_->maxFrames_ * numChannels);
+
+		// Files are created by the writer once recording starts.
+		const i32 numFiles = impl_->perTrack_ ? numChannels : 1;
+		impl_->flushFiles_.resize(numFiles);
+		impl_->dataSizeOffsets_.resize(numFiles);
+		if(compressed)
+			impl_->encoders_.resize(numFiles, nullptr);
+		impl_->peaks_.resize(numFiles, nullptr);
+		impl_->flushJobs_.resize(numFiles);
+		for(i32 idx = 0; idx < numFiles; ++idx)
+		{
+			auto& jobDesc = impl_->flushJobs_[idx];
+			jobDesc.func_ = [](i32 param, void* data) {
+				static_cast<OutputStreamImpl*>(data)->FlushFile(param);
+			};
+			jobDesc.param_ = idx;
+			jobDesc.data_ = impl_;
+			jobDesc.name_ = "SoundBuffer flush";
 		}
-		impl_->flushFile_ = Core::File(impl_->flushFileName_.data(), Core::FileFlags::CREATE | Core::FileFlags::WRITE);
 	}
 
 	OutputStream::~OutputStream()
 	{
+		// Never started, so there's nothing on disk to finalise.
+		if(!impl_->started_)
+		{
+			delete impl_;
+			return;
+		}
+
 		FlushData();
 
-		if(impl_->flushCounter_)
+		// Wait for the writer job to finish, then claim writing for ourselves so nothing is left in the queue.
+		RT_CHECK(WAIT);
+		while(Core::AtomicCmpExchg(&impl_->writing_, 1, 0) != 0)
+			Core::Sleep(0.001);
+		impl_->WriteBlocks();
+
+		// Samples are already in place, just patch the headers.
+		const i32 fileChannels = impl_->perTrack_ ? 1 : impl_->numChannels_;
+		for(i32 idx = 0; idx < impl_->flushFiles_.size(); ++idx)
 		{
-			Job::Manager::WaitForCounter(impl_->flushCounter_, 0);
-		}
+			RT_CHECK(FILE_IO);
+			if(impl_->encoders_.size() > 0)
+			{
+				impl_->encoders_[idx]->Finish();
+				delete impl_->encoders_[idx];
+			}
+			else if(impl_->flushFiles_[idx])
+			{
+				Wav::FinalizeStream(impl_->flushFiles_[idx], impl_->dataSizeOffsets_[idx], impl_->totalFrames_ * fileChannels * sizeof(f32), impl_->totalFrames_);
+			}
 
-		SaveSoundAsync(impl_->flushFileName_.data(), impl_->saveFileName_.data(), Sound::Format::F32, 1, impl_->sampleRate_);
+			if(impl_->flushFiles_[idx])
+			{
+				Core::Array<char, Core::MAX_PATH_LENGTH> fileName;
+				GetFileName(idx, fileName.data(), fileName.size());
+				impl_->peaks_[idx]->Finish();
+				impl_->peaks_[idx]->SaveSidecar(fileName.data(), impl_->flushFiles_[idx].Size());
+			}
+			delete impl_->peaks_[idx];
+		}
 
 		delete impl_;
 	}
 
 	void OutputStream::FlushData()
 	{
-		if(impl_->flushCounter_)
+		if(impl_->block_)
 		{
-			Job::Manager::WaitForCounter(impl_->flushCounter_, 0);
+			// Hand block to the writer, even if empty, as the pre-roll goes out with it.
+			impl_->block_->numFrames_ = impl_->numFrames_;
+			impl_->fullBlocks_.Write(&impl_->block_, 1);
+			impl_->totalFrames_ += impl_->numFrames_;
+
+			// Only kick the writer if it isn't already running, it'll pick this block up otherwise.
+			// If it's just finishing, the block waits for the next flush.
+			if(Core::AtomicCmpExchg(&impl_->writing_, 1, 0) == 0)
+			{
+				RT_CHECK(SYSCALL);
+				Job::Manager::RunJobs(&impl_->writerJob_, 1, nullptr);
+			}
+		}
+		else if(impl_->numFrames_ > 0)
+		{
+			Core::AtomicInc(&impl_->numDroppedBlocks_);
 		}
 
-		// Swap buffers.
-		std::swap(impl_->flushBuffer_, impl_->buffer_);
-
-		// Kick job to copy in background to avoid hitching on audio thread.
-		Job::JobDesc jobDesc;
-		jobDesc.func_ = [](i32 param, void* data) {
-			OutputStreamImpl* impl = static_cast<OutputStreamImpl*>(data);
-			impl->flushFile_.Write(impl->flushBuffer_.data(), param);
-		};
-
-		jobDesc.param_ = impl_->size_;
-		jobDesc.data_ = impl_;
-		jobDesc.name_ = "SoundBuffer flush";
-		Job::Manager::RunJobs(&jobDesc, 1, &impl_->flushCounter_);
-
-		impl_->size_ = 0;
+		// Never wait for the writer, if every block is queued drop frames until one is returned.
+		impl_->block_ = nullptr;
+		impl_->freeBlocks_.Read(&impl_->block_, 1);
+		impl_->numFrames_ = 0;
 	}
 		
-	void OutputStream::Push(const void* data, i32 size)
+	void OutputStream::Push(const f32* const* channels, i32 numFrames)
+	{
+		for(i32 offset = 0; offset < numFrames; )
+		{
+			if(impl_->numFrames_ == impl_->maxFrames_)
+			{
+				FlushData();
+			}
+
+			const i32 numCopy = Core::Min(numFrames - offset, impl_->maxFrames_ - impl_->numFrames_);
+			if(impl_->block_)
+			{
+				for(i32 ch = 0; ch < impl_->numChannels_; ++ch)
+				{
+					f32* dest = impl_->block_->samples_.data() + ch * impl_->maxFrames_ + impl_->numFrames_;
+					memcpy(dest, channels[ch] + offset, sizeof(f32) * numCopy);
+				}
+			}
+			impl_->numFrames_ += numCopy;
+			offset += numCopy;
+		}
+	}
+
+	void OutputStream::SetPreRoll(PreRollBuffer* preRoll)
 	{
-		// Always alloc double what's needed.
-		i32 requiredSize = impl_->size_ + size;
-		if(requiredSize > impl_->buffer_.size())
+		if(preRoll->GetNumChannels() != impl_->numChannels_ || preRoll->GetNumFrames() == 0 || impl_->totalFrames_ > 0 || impl_->numFrames_ > 0)
 		{
-			FlushData();
+			preRoll->Release();
+			return;
 		}
 
-		memcpy(impl_->buffer_.data() + impl_->size_, data, size);
-		impl_->size_ += size;
-		impl_->totalSize_ += size;
+		impl_->preRoll_ = preRoll;
+		Core::AtomicExchg(&impl_->preRollFiles_, impl_->flushFiles_.size());
+		impl_->totalFrames_ += preRoll->GetNumFrames();
+
+		// Write it out with an empty block now, so it's released straight away rather than after the first full block.
+		FlushData();
+	}
+
+	i32 OutputStream::GetNumDroppedBlocks() const
+	{
+		return impl_->numDroppedBlocks_;
+	}
+
+	f32 OutputStream::GetStallTolerance() const
+	{
+		// The block being filled can't absorb a stall, the rest of the pool can.
+		return (f32)((NUM_BLOCKS - 1) * impl_->maxFrames_) / (f32)impl_->sampleRate_;
+	}
+
+	void OutputStream::Start()
+	{
+		impl_->soundBufferID_ = Core::AtomicInc(&SoundBufferID);
+		impl_->started_ = true;
+	}
+
+	i32 OutputStream::GetNumChannels() const
+	{
+		return impl_->numChannels_;
+	}
+
+	i32 OutputStream::GetSampleRate() const
+	{
+		return impl_->sampleRate_;
+	}
+
+	bool OutputStream::IsPerTrack() const
+	{
+		return impl_->perTrack_;
+	}
+
+	bool OutputStream::IsCompressed() const
+	{
+		return impl_->compressed_;
 	}
 
 	u32 OutputStream::GetID() const
@@ -479,4 +1488,166 @@ namespace Sound
 		return impl_->soundBufferID_;
 	}
 
+	i32 OutputStream::GetNumFiles() const
+	{
+		return impl_->flushFiles_.size();
+	}
+
+	void OutputStream::GetFileName(i32 fileIdx, char* outFileName, i32 maxLength) const
+	{
+		GetFileName(impl_->soundBufferID_, impl_->perTrack_ ? fileIdx : -1, impl_->compressed_, outFileName, maxLength);
+	}
+
+	void OutputStream::GetFileName(u32 id, i32 track, bool compressed, char* outFileName, i32 maxLength)
+	{
+		const char* extension = compressed ? "lpr" : "wav";
+		if(track < 0)
+			sprintf_s(outFileName, maxLength, "audio_out_%08u.%s", id, extension);
+		else
+			sprintf_s(outFileName, maxLength, "audio_out_%08u_%02d.%s", id, track + 1, extension);
+	}
+
+	struct InputStreamImpl
+	{
+		Core::File file_;
+		/// Format, channels, sample rate & number of frames. Raw data isn't loaded.
+		Data data_;
+		/// Offset of sample data in file.
+		i64 dataOffset_ = 0;
+		/// Current frame.
+		i64 position_ = 0;
+		/// Staging buffer for converting from file format.
+		Core::Vector<u8> readBuffer_;
+		/// Decoders for compressed formats.
+		Ogg::Decoder ogg_;
+		Lossless::Decoder lossless_;
+	};
+
+	InputStream::InputStream(const char* fileName)
+	{
+		impl_ = new InputStreamImpl();
+		impl_->file_ = Core::File(fileName, Core::FileFlags::READ);
+		if(impl_->file_)
+		{
+			u32 tag = 0;
+			impl_->file_.Read(&tag, sizeof(tag));
+			impl_->file_.Seek(0);
+
+			if(tag == Wav::TAG || tag == Wav::RF64_ID)
+			{
+				if(Wav::ReadHeader(impl_->file_))
+					Wav::ReadChunks(impl_->file_, impl_->data_, &impl_->dataOffset_);
+			}
+			else if(tag == Ogg::TAG)
+			{
+				if(impl_->ogg_.Open(impl_->file_))
+				{
+					impl_->data_.numChannels_ = impl_->ogg_.numChannels_;
+					impl_->data_.sampleRate_ = impl_->ogg_.sampleRate_;
+					impl_->data_.numSamples_ = impl_->ogg_.numFrames_;
+					impl_->data_.format_ = Format::F32;
+				}
+			}
+			else if(tag == Lossless::TAG)
+			{
+				if(impl_->lossless_.Open(impl_->file_))
+				{
+					impl_->data_.numChannels_ = impl_->lossless_.numChannels_;
+					impl_->data_.sampleRate_ = impl_->lossless_.sampleRate_;
+					impl_->data_.numSamples_ = impl_->lossless_.numFrames_;
+					impl_->data_.format_ = Format::F32;
+				}
+			}
+		}
+		Seek(0);
+	}
+
+	InputStream::~InputStream()
+	{
+		delete impl_;
+	}
+
+	i32 InputStream::Read(f32* data, i32 numFrames)
+	{
+		const auto& soundData = impl_->data_;
+		numFrames = (i32)Core::Min((i64)numFrames, soundData.numSamples_ - impl_->position_);
+		if(numFrames <= 0)
+			return 0;
+
+		const i32 numValues = numFrames * soundData.numChannels_;
+		if(impl_->ogg_.vorbis_)
+		{
+			numFrames = impl_->ogg_.Read(data, numFrames);
+		}
+		else if(impl_->lossless_)
+		{
+			numFrames = impl_->lossless_.Read(data, numFrames);
+		}
+		else if(soundData.format_ == Format::F32)
+		{
+			numFrames = (i32)(impl_->file_.Read(data, sizeof(f32) * numValues) / (sizeof(f32) * soundData.numChannels_));
+		}
+		else
+		{
+			const i32 sampleSize = GetSampleSize(soundData.format_);
+			impl_->readBuffer_.resize(numValues * sampleSize);
+			numFrames = (i32)(impl_->file_.Read(impl_->readBuffer_.data(), numValues * sampleSize) / (sampleSize * soundData.numChannels_));
+			ConvertToF32(soundData.format_, impl_->readBuffer_.data(), data, numFrames * soundData.numChannels_);
+		}
+
+		impl_->position_ += numFrames;
+		return numFrames;
+	}
+
+	bool InputStream::Seek(i64 frame)
+	{
+		const auto& soundData = impl_->data_;
+		if(!*this || frame < 0 || frame > soundData.numSamples_)
+			return false;
+
+		if(impl_->ogg_.vorbis_)
+		{
+			if(!impl_->ogg_.Seek(frame))
+				return false;
+		}
+		else if(impl_->lossless_)
+		{
+			if(!impl_->lossless_.Seek(frame))
+				return false;
+		}
+		else
+		{
+			const i32 frameSize = soundData.numChannels_ * GetSampleSize(soundData.format_);
+			impl_->file_.Seek(impl_->dataOffset_ + frame * frameSize);
+		}
+		impl_->position_ = frame;
+		return true;
+	}
+
+	i64 InputStream::Tell() const
+	{
+		return impl_->position_;
+	}
+
+	i64 InputStream::GetNumFrames() const
+	{
+		return impl_->data_.numSamples_;
+	}
+
+	i32 InputStream::GetNumChannels() const
+	{
+		return impl_->data_.numChannels_;
+	}
+
+	i32 InputStream::GetSampleRate() const
+	{
+		return impl_->data_.sampleRate_;
+	}
+
+	InputStream::operator bool() const
+	{
+		const auto& soundData = impl_->data_;
+		return soundData.format_ != Format::UNKNOWN && soundData.numChannels_ > 0 && (impl_->ogg_.vorbis_ || impl_->lossless_ || impl_->dataOffset_ > 0);
+	}
+
 } // namespace Sound
@@ -1,18 +1,24 @@
 #pragma once
 #include "core/types.h"
+#include "resampler.h"
 
 namespace Core
 {
 	class File;
 } // namespace Core
 
+class PreRollBuffer;
+
 namespace Sound
 {
 	enum class Format
 	{
 		UNKNOWN = 0,
 		S16,
-		F32
+		F32,
+		/// Packed 3 byte samples.
+		S24,
+		S32,
 	};
 
 	struct Data
@@ -29,13 +35,73 @@ namespace Sound
 
 		i32 numChannels_ = 0;
 		i32 sampleRate_ = 0;
-		i32 numSamples_ = 0;
+		/// Number of frames.
+		i64 numSamples_ = 0;
 		Format format_ = Format::UNKNOWN;
-		u32 numBytes_ = 0;
+		i64 numBytes_ = 0;
 		u8* rawData_ = nullptr;
 	};
 
 
+	/**
+	 * Size of a single sample in bytes.
+	 */
+	i32 GetSampleSize(Format format);
+
+	/**
+	 * Convert samples between @a format and f32.
+	 */
+	void ConvertToF32(Format format, const void* in, f32* out, i64 numSamples);
+	void ConvertFromF32(Format format, const f32* in, void* out, i64 numSamples);
+
+	/**
+	 * Interleave or deinterleave f32 channels.
+	 */
+	void Interleave(const f32* const* in, i32 numChannels, i32 numFrames, f32* out);
+	void Deinterleave(const f32* in, i32 numChannels, i32 numFrames, f32* const* out);
+
+	/**
+	 * Convert sound data to another format.
+	 */
+	Data Convert(const Data& data, Format format);
+
+	/**
+	 * Resample sound data to @a sampleRate. Output is always f32.
+	 */
+	Data Resample(const Data& data, i32 sampleRate, ResamplerQuality quality = ResamplerQuality::HIGH);
+
+	/**
+	 * Read only view of a WAV file's samples.
+	 * The file is memory mapped so opening is O(1) and residency is left to the OS page cache.
+	 * If the file can't be mapped, or samples wouldn't be aligned, the data chunk is copied instead.
+	 */
+	class DataView
+	{
+	public:
+		DataView() = default;
+		DataView(const char* fileName);
+		~DataView();
+		DataView(const DataView&) = delete;
+		DataView& operator=(const DataView&) = delete;
+		DataView(DataView&& other);
+		DataView& operator=(DataView&& other);
+		void swap(DataView& other);
+		operator bool() const;
+
+		/// Interleaved samples, in GetFormat().
+		const void* GetSamples() const;
+		i64 GetNumBytes() const;
+		i64 GetNumFrames() const;
+		i32 GetNumChannels() const;
+		i32 GetSampleRate() const;
+		Format GetFormat() const;
+		/// Is the view backed by a mapping rather than a copy?
+		bool IsMapped() const;
+
+	private:
+		struct DataViewImpl* impl_ = nullptr;
+	};
+
 	/**
 	 * Load a sound from a given file.
 	 */
@@ -47,28 +113,120 @@ namespace Sound
 	void Save(Core::File& file, const Data& soundData);
 
 	/**
-	 * Save a sound from raw.
+	 * Save a sound from raw, converting to @a saveFormat & @a saveSampleRate if specified.
 	 */
-	void Save(Core::File& rawFile, Core::File& outFile, Format format, i32 numChannels, i32 sampleRate);
+	void Save(Core::File& rawFile, Core::File& outFile, Format format, i32 numChannels, i32 sampleRate,
+		Format saveFormat = Format::UNKNOWN, i32 saveSampleRate = 0);
 
+	/**
+	 * Begin saving a sound of unknown length. Sample data in @a format is then written directly to @a file.
+	 * @return Offset to pass to EndSaveStream.
+	 */
+	i64 BeginSaveStream(Core::File& file, Format format, i32 numChannels, i32 sampleRate);
+
+	/**
+	 * Finish a sound begun with BeginSaveStream, once all @a numFrames frames (@a numBytes bytes) are written.
+	 */
+	void EndSaveStream(Core::File& file, i64 streamOffset, i64 numBytes, i64 numFrames);
 
 	/**
 	 * Output stream.
+	 * Records non-interleaved channels straight into wav or lossless compressed files, either
+	 * one interleaved file or one file per track. Interleaving, encoding & writing happen on jobs,
+	 * which also build each file's peak pyramid sidecar.
+	 * Frames are pushed into a fixed pool of blocks, so pushing never allocates or waits on the writer.
+	 * If the writer falls behind by more than the pool, blocks of frames are dropped & counted.
+	 * Wav files are upgraded to RF64 on completion if they outgrow 4GB, so recordings needn't be split.
 	 */
 	class OutputStream
 	{
 	public:
+		/// Minimum size of each block in bytes, and minimum duration of each block in seconds.
 		static const i32 FLUSH_SIZE = 1024 * 1024 * 1;
+		static constexpr f32 FLUSH_TIME = 0.25f;
+		/// Blocks allocated up front, bounding how long writing can stall before frames are dropped.
+		static const i32 NUM_BLOCKS = 16;
 		static volatile i32 SoundBufferID;
 
-		OutputStream(i32 sampleRate);
+		OutputStream(i32 sampleRate, i32 numChannels = 1, bool perTrack = false, bool compressed = false);
 		~OutputStream();
 		void FlushData();
-		void Push(const void* data, i32 size);
+		void Push(const f32* const* channels, i32 numFrames);
+
+		/**
+		 * Prepend frames captured before the recording started. @a preRoll isn't copied, it's written
+		 * out straight away by the writer job & then released.
+		 * @pre Nothing has been pushed yet.
+		 */
+		void SetPreRoll(PreRollBuffer* preRoll);
+
+		/// Blocks of frames dropped because writing fell behind.
+		i32 GetNumDroppedBlocks() const;
+
+		/// Seconds writing can stall for before frames are dropped.
+		f32 GetStallTolerance() const;
+
+		/**
+		 * Take an ID & start recording. Until then the stream has no files, so streams built ahead of time
+		 * leave nothing behind if they go unused. Doesn't touch disk, files are created by the writer job.
+		 * @pre Called before Push & SetPreRoll.
+		 */
+		void Start();
+
+		i32 GetNumChannels() const;
+		i32 GetSampleRate() const;
+		bool IsPerTrack() const;
+		bool IsCompressed() const;
+
 		u32 GetID() const;
 
+		/// Files being written, one per track for per track recordings.
+		i32 GetNumFiles() const;
+		void GetFileName(i32 fileIdx, char* outFileName, i32 maxLength) const;
+
+		/**
+		 * Get file name for a recording.
+		 * @param track Track index for per track recordings, or -1.
+		 * @param compressed Lossless compressed recordings use the .lpr extension.
+		 */
+		static void GetFileName(u32 id, i32 track, bool compressed, char* outFileName, i32 maxLength);
+
 	private:
 		struct OutputStreamImpl* impl_ = nullptr;
 	};
 
+	/**
+	 * Input stream.
+	 * Reads a sound incrementally as interleaved f32 frames, rather than loading it all up front.
+	 * Not thread safe, only one thread should read & seek at a time.
+	 */
+	class InputStream
+	{
+	public:
+		InputStream(const char* fileName);
+		~InputStream();
+		InputStream(const InputStream&) = delete;
+		InputStream& operator=(const InputStream&) = delete;
+
+		/**
+		 * Read up to @a numFrames frames.
+		 * @return Number of frames read, less than @a numFrames at end of stream.
+		 */
+		i32 Read(f32* data, i32 numFrames);
+
+		/**
+		 * Seek to frame.
+		 */
+		bool Seek(i64 frame);
+
+		i64 Tell() const;
+		i64 GetNumFrames() const;
+		i32 GetNumChannels() const;
+		i32 GetSampleRate() const;
+		operator bool() const;
+
+	private:
+		struct InputStreamImpl* impl_ = nullptr;
+	};
+
 } // namespace Sound
@@ -0,0 +1,294 @@
+#include "tests.h"
+#include "lossless.h"
+#include "peak_pyramid.h"
+#include "sound.h"
+#include "core/array.h"
+#include "core/debug.h"
+#include "core/file.h"
+#include "core/misc.h"
+#include "core/vector.h"
+
+#include <cmath>
+#include <cstring>
+
+namespace Tests
+{
+	namespace
+	{
+		static const i32 NUM_CHANNELS = 2;
+		static const i32 SAMPLE_RATE = 48000;
+		/// Spans several lossless blocks & peaks, with partial ones at the end.
+		static const i32 NUM_FRAMES = Sound::Lossless::BLOCK_FRAMES * 3 + 123;
+		static const i32 NUM_PEAKS = 64;
+
+		static const char* WAV_FILE_NAME = "test_roundtrip.wav";
+		static const char* RF64_FILE_NAME = "test_roundtrip_rf64.wav";
+		static const char* LOSSLESS_FILE_NAME = "test_roundtrip.lpr";
+
+		/**
+		 * Test sound. The first channel is 24 bit fixed point, as recorded from an integer device.
+		 * The second is arbitrary f32, including values out of range & denormals.
+		 */
+		struct Signal
+		{
+			Signal()
+			{
+				data_.resize(NUM_FRAMES * NUM_CHANNELS);
+				interleaved_.resize(NUM_FRAMES * NUM_CHANNELS);
+				channels_.resize(NUM_CHANNELS);
+				for(i32 ch = 0; ch < NUM_CHANNELS; ++ch)
+					channels_[ch] = data_.data() + ch * NUM_FRAMES;
+
+				u32 seed = 0x1234567;
+				for(i32 frame = 0; frame < NUM_FRAMES; ++frame)
+				{
+					const f32 sine = std::sin((f32)frame * 0.01f) * 0.8f;
+					channels_[0][frame] = std::round(sine * 8388607.0f) / 8388608.0f;
+
+					seed = seed * 1664525 + 1013904223;
+					channels_[1][frame] = sine * 1.5f + (f32)(seed >> 8) * (1.0f / 16777216.0f) * 1.0e-3f;
+				}
+				channels_[1][0] = 1.0e-40f;
+				channels_[1][1] = -4.0f;
+
+				Sound::Interleave(channels_.data(), NUM_CHANNELS, NUM_FRAMES, interleaved_.data());
+			}
+
+			Core::Vector<f32> data_;
+			Core::Vector<f32*> channels_;
+			Core::Vector<f32> interleaved_;
+		};
+
+		bool Check(bool condition, const char* test, const char* what)
+		{
+			if(!condition)
+				Core::Log("Test \"%s\" failed: %s\n", test, what);
+			return condition;
+		}
+
+		void RemoveFile(const char* fileName)
+		{
+			if(Core::FileExists(fileName))
+				Core::FileRemove(fileName);
+		}
+
+		/// Loaded sound must be bit exact, including the format.
+		bool CheckData(const Sound::Data& data, const Signal& signal, const char* test)
+		{
+			if(!Check(data.format_ == Sound::Format::F32 && data.numChannels_ == NUM_CHANNELS &&
+				data.sampleRate_ == SAMPLE_RATE && data.numSamples_ == NUM_FRAMES, test, "format mismatch"))
+				return false;
+			return Check(memcmp(data.rawData_, signal.interleaved_.data(), sizeof(f32) * signal.interleaved_.size()) == 0,
+				test, "samples mismatch");
+		}
+
+		/// Streamed read must be bit exact, then seek & read from the middle.
+		bool CheckInputStream(const char* fileName, const Signal& signal, const char* test)
+		{
+			Sound::InputStream stream(fileName);
+			if(!Check(stream && stream.GetNumChannels() == NUM_CHANNELS && stream.GetNumFrames() == NUM_FRAMES, test, "stream open failed"))
+				return false;
+
+			Core::Vector<f32> samples;
+			samples.resize(NUM_FRAMES * NUM_CHANNELS);
+			if(!Check(stream.Read(samples.data(), NUM_FRAMES) == NUM_FRAMES, test, "stream read short"))
+				return false;
+			if(!Check(memcmp(samples.data(), signal.interleaved_.data(), sizeof(f32) * samples.size()) == 0, test, "stream samples mismatch"))
+				return false;
+
+			const i32 seekFrame = NUM_FRAMES / 2 + 7;
+			const i32 numFrames = 100;
+			if(!Check(stream.Seek(seekFrame) && stream.Read(samples.data(), numFrames) == numFrames, test, "stream seek failed"))
+				return false;
+			return Check(memcmp(samples.data(), signal.interleaved_.data() + seekFrame * NUM_CHANNELS, sizeof(f32) * numFrames * NUM_CHANNELS) == 0,
+				test, "stream samples mismatch after seek");
+		}
+
+		bool TestWav(const Signal& signal)
+		{
+			const char* test = "wav";
+			RemoveFile(WAV_FILE_NAME);
+			{
+				Sound::Data data;
+				data.numChannels_ = NUM_CHANNELS;
+				data.sampleRate_ = SAMPLE_RATE;
+				data.numSamples_ = NUM_FRAMES;
+				data.format_ = Sound::Format::F32;
+				data.numBytes_ = sizeof(f32) * signal.interleaved_.size();
+				data.rawData_ = new u8[data.numBytes_];
+				memcpy(data.rawData_, signal.interleaved_.data(), data.numBytes_);
+
+				Core::File file(WAV_FILE_NAME, Core::FileFlags::CREATE | Core::FileFlags::WRITE);
+				if(!Check(!!file, test, "create failed"))
+					return false;
+				Sound::Save(file, data);
+			}
+
+			Core::File file(WAV_FILE_NAME, Core::FileFlags::READ);
+			return CheckData(Sound::Load(file), signal, test) && CheckInputStream(WAV_FILE_NAME, signal, test);
+		}
+
+		/**
+		 * Streams only become RF64 past 4GB, so write a stream & upgrade its header by hand,
+		 * as laid out by EBU Tech 3306: RF64 id, then a ds64 chunk in place of the reserved JUNK chunk.
+		 */
+		bool TestRF64(const Signal& signal)
+		{
+			const char* test = "rf64";
+			RemoveFile(RF64_FILE_NAME);
+			{
+				Core::File file(RF64_FILE_NAME, Core::FileFlags::CREATE | Core::FileFlags::WRITE);
+				if(!Check(!!file, test, "create failed"))
+					return false;
+
+				const i64 dataSizeOffset = Sound::BeginSaveStream(file, Sound::Format::F32, NUM_CHANNELS, SAMPLE_RATE);
+				const i64 numBytes = sizeof(f32) * signal.interleaved_.size();
+				file.Write(signal.interleaved_.data(), numBytes);
+
+				const u32 rf64Id = '46FR';
+				const u32 ds64Id = '46sd';
+				const u32 ds64Size = 28;
+				const u32 unknownSize = 0xffffffff;
+				const u64 riffSize = (u64)(dataSizeOffset + sizeof(u32) + numBytes - 8);
+				const u64 dataSize = (u64)numBytes;
+				const u64 sampleCount = NUM_FRAMES;
+				const u32 tableLength = 0;
+				file.Seek(0);
+				file.Write(&rf64Id, sizeof(rf64Id));
+				file.Write(&unknownSize, sizeof(unknownSize));
+				file.Seek(12);
+				file.Write(&ds64Id, sizeof(ds64Id));
+				file.Write(&ds64Size, sizeof(ds64Size));
+				file.Write(&riffSize, sizeof(riffSize));
+				file.Write(&dataSize, sizeof(dataSize));
+				file.Write(&sampleCount, sizeof(sampleCount));
+				file.Write(&tableLength, sizeof(tableLength));
+				file.Seek(dataSizeOffset);
+				file.Write(&unknownSize, sizeof(unknownSize));
+			}
+
+			Core::File file(RF64_FILE_NAME, Core::FileFlags::READ);
+			const bool result = CheckData(Sound::Load(file), signal, test) && CheckInputStream(RF64_FILE_NAME, signal, test);
+			file = Core::File();
+			RemoveFile(RF64_FILE_NAME);
+			return result;
+		}
+
+		bool TestLossless(const Signal& signal)
+		{
+			const char* test = "lossless";
+			RemoveFile(LOSSLESS_FILE_NAME);
+			{
+				Core::File file(LOSSLESS_FILE_NAME, Core::FileFlags::CREATE | Core::FileFlags::WRITE);
+				if(!Check(!!file, test, "create failed"))
+					return false;
+
+				// Odd sized pushes, so blocks are filled across calls.
+				Sound::Lossless::Encoder encoder(file, NUM_CHANNELS, SAMPLE_RATE);
+				Core::Array<const f32*, NUM_CHANNELS> channels;
+				for(i32 frame = 0; frame < NUM_FRAMES;)
+				{
+					const i32 numFrames = Core::Min(NUM_FRAMES - frame, 1000);
+					for(i32 ch = 0; ch < NUM_CHANNELS; ++ch)
+						channels[ch] = signal.channels_[ch] + frame;
+					encoder.Encode(channels.data(), numFrames);
+					frame += numFrames;
+				}
+				encoder.Finish();
+			}
+
+			Core::File file(LOSSLESS_FILE_NAME, Core::FileFlags::READ);
+			const bool result = CheckData(Sound::Load(file), signal, test) && CheckInputStream(LOSSLESS_FILE_NAME, signal, test);
+			file = Core::File();
+			RemoveFile(LOSSLESS_FILE_NAME);
+			return result;
+		}
+
+		bool CheckPeaks(const Sound::PeakPyramid& peaks, const Sound::PeakPyramid& expected, const char* test, const char* what)
+		{
+			if(!Check(peaks.GetNumChannels() == NUM_CHANNELS && peaks.GetNumFrames() == NUM_FRAMES &&
+				peaks.GetNumLevels() == expected.GetNumLevels(), test, what))
+				return false;
+
+			Core::Array<Sound::Peak, NUM_PEAKS> peakData;
+			Core::Array<Sound::Peak, NUM_PEAKS> expectedData;
+			for(i32 ch = 0; ch < NUM_CHANNELS; ++ch)
+			{
+				peaks.GetPeaks(ch, 0, NUM_FRAMES, peakData.data(), NUM_PEAKS);
+				expected.GetPeaks(ch, 0, NUM_FRAMES, expectedData.data(), NUM_PEAKS);
+				if(!Check(memcmp(peakData.data(), expectedData.data(), sizeof(Sound::Peak) * NUM_PEAKS) == 0, test, what))
+					return false;
+			}
+			return true;
+		}
+
+		/// Needs the file written by TestWav as the source sound.
+		bool TestPeakSidecar(const Signal& signal)
+		{
+			const char* test = "peak sidecar";
+			Core::Array<char, Core::MAX_PATH_LENGTH> sidecarName;
+			Sound::PeakPyramid::GetSidecarName(WAV_FILE_NAME, sidecarName.data(), sidecarName.size());
+
+			i64 sourceSize = 0;
+			{
+				Core::File sourceFile(WAV_FILE_NAME, Core::FileFlags::READ);
+				if(!Check(!!sourceFile, test, "source missing"))
+					return false;
+				sourceSize = sourceFile.Size();
+			}
+
+			// Built from whole peaks at a time, so RMS sums in the same order as a rebuild.
+			Sound::PeakPyramid expected(NUM_CHANNELS, SAMPLE_RATE);
+			Core::Array<const f32*, NUM_CHANNELS> channels;
+			for(i32 frame = 0; frame < NUM_FRAMES;)
+			{
+				const i32 numFrames = Core::Min(NUM_FRAMES - frame, Sound::PeakPyramid::BASE_FRAMES * 2);
+				for(i32 ch = 0; ch < NUM_CHANNELS; ++ch)
+					channels[ch] = signal.channels_[ch] + frame;
+				expected.Push(channels.data(), numFrames);
+				frame += numFrames;
+			}
+			expected.Finish();
+			if(!Check(expected.SaveSidecar(WAV_FILE_NAME, sourceSize), test, "save failed"))
+				return false;
+
+			bool result = true;
+			{
+				Sound::PeakPyramid loaded;
+				result = Check(loaded.LoadOrBuild(WAV_FILE_NAME), test, "load failed") &&
+					CheckPeaks(loaded, expected, test, "loaded peaks mismatch");
+			}
+			if(result)
+			{
+				Core::File sidecarFile(sidecarName.data(), Core::FileFlags::READ);
+				Sound::PeakPyramid stale;
+				result = Check(!stale.Load(sidecarFile, sourceSize + 1), test, "stale sidecar accepted");
+			}
+			if(result)
+			{
+				// Missing sidecar is rebuilt by streaming the source.
+				RemoveFile(sidecarName.data());
+				Sound::PeakPyramid rebuilt;
+				result = Check(rebuilt.LoadOrBuild(WAV_FILE_NAME), test, "rebuild failed") &&
+					CheckPeaks(rebuilt, expected, test, "rebuilt peaks mismatch") &&
+					Check(Core::FileExists(sidecarName.data()), test, "rebuilt sidecar not saved");
+			}
+			RemoveFile(sidecarName.data());
+			return result;
+		}
+	}
+
+	i32 RunAll()
+	{
+		const Signal signal;
+		i32 numFailed = 0;
+		numFailed += TestWav(signal) ? 0 : 1;
+		numFailed += TestRF64(signal) ? 0 : 1;
+		numFailed += TestLossless(signal) ? 0 : 1;
+		numFailed += TestPeakSidecar(signal) ? 0 : 1;
+		RemoveFile(WAV_FILE_NAME);
+
+		Core::Log("Tests: %d of 4 passed\n", 4 - numFailed);
+		return numFailed;
+	}
+} // namespace Tests
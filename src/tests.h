@@ -0,0 +1,13 @@
+#pragma once
+
+#include "core/types.h"
+
+namespace Tests
+{
+	/**
+	 * Run round trip tests of the file formats: WAV & RF64, lossless and peak sidecars.
+	 * Files are written to the working directory & removed afterwards.
+	 * @return Number of failed tests.
+	 */
+	i32 RunAll();
+} // namespace Tests